@@ -19,15 +19,28 @@
  *  let err = libcall(if_spidermonkey, 'execute', 'vim.execute("echo \"hello, v8\"")')
  *  let err = libcall(if_spidermonkey, 'execute', 'vim.eval("&tw")')
  *  let err = libcall(if_spidermonkey, 'execute', 'load("foo.js")')
+ *  call libcall(if_spidermonkey, 'uninit', '')   " e.g. on VimLeavePre
+ *
+ * Compiled scripts of load()ed files are cached in ~/.cache/if_spidermonkey
+ * and refreshed when the file is modified.  To use another directory, or
+ * to disable it with '', set g:if_spidermonkey_cachedir before init.
  *
  */
 #include <dlfcn.h>
 #include <jsapi.h>
+#include <jsxdrapi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <algorithm>
 #include <string>
 #include <sstream>
 #include <map>
 
-typedef std::map<void*, jsval> LookupMap;
+/* list_T or dict_T => its VimList/VimDict proxy */
+typedef std::map<void*, JSObject*> ProxyMap;
 
 typedef unsigned char char_u;
 typedef unsigned short short_u;
@@ -113,6 +126,10 @@ typedef struct
 #define VAR_LOCKED  1	/* locked with lock(), can use unlock() */
 #define VAR_FIXED   2	/* locked forever */
 
+/* return values of dict_add() and hash_remove() */
+#define OK		1
+#define FAIL		0
+
 /*
  * Structure to hold an item of a list: an internal variable without a name.
  */
@@ -223,17 +240,63 @@ static struct vim {
   void (*update_screen) (int type);
   int (*msg) (char_u *s);
   int (*emsg) (char_u *s);
+  char_u * (*alloc) (unsigned size);
+  void (*vim_free) (void *x);
+  void (*clear_tv) (typval_T *varp);
+  void (*list_unref) (list_T *l);
+  char_u * (*vim_strsave) (char_u *string);
+  list_T * (*list_alloc) ();
+  dict_T * (*dict_alloc) ();
+  void (*listitem_remove) (list_T *l, listitem_T *item);
+  dictitem_T * (*dictitem_alloc) (char_u *key);
+  void (*dictitem_free) (dictitem_T *item);
+  int (*dict_add) (dict_T *d, dictitem_T *item);
+  hashitem_T * (*hash_find) (hashtab_T *ht, char_u *key);
+  int (*hash_remove) (hashtab_T *ht, hashitem_T *hi);
+  void (*list_append) (list_T *l, listitem_T *item);
+  listitem_T * (*list_find) (list_T *l, long n);
+  dictitem_T * (*dict_find) (dict_T *d, char_u *key, int len);
 } vim;
 
 static void *dll_handle = NULL;
 static JSRuntime *sm_rt;
 static JSContext *sm_cx;
 static JSObject  *sm_global;
+static JSObject  *sm_array_proto;
+
+/*
+ * g:__if_spidermonkey_pin
+ * Lists and Dictionaries referenced by proxies.  Vim's garbage collector
+ * frees what is not reachable from a variable, so they are linked here.
+ * The variable is locked and its list is referenced until uninit().
+ */
+static list_T *sm_pin;
+
+/* Live proxies.  An entry is removed when its proxy is finalized. */
+static ProxyMap sm_proxies;
+
+/*
+ * g:if_spidermonkey_cachedir
+ * Directory for XDR encoded scripts of load()ed files.  Empty to disable.
+ */
+static std::string sm_cache_dir;
+
+/*
+ * Recently executed strings, most recently used first.  The script
+ * objects are rooted by slot address, so entries are moved within the
+ * fixed array.
+ */
+#define SCRIPT_CACHE_SIZE 16
+static struct script_cache_entry {
+  std::string source;
+  JSObject *obj;        /* script object owning the JSScript */
+} sm_script_cache[SCRIPT_CACHE_SIZE];
 
 /* API */
 extern "C" {
 const char *init(const char *dll_path);
 const char *execute(const char *expr);
+const char *uninit(const char *dummy);
 }
 
 static const char *init_vim();
@@ -267,7 +330,43 @@ static JSFunctionSpec sm_vim_methods[] = {
 };
 
 
-static jsval vim_to_spidermonkey(JSContext *cx, typval_T *tv, int depth, LookupMap *lookup_map);
+/*
+ * VimList and VimDict classes
+ *
+ * Proxies of list_T and dict_T.  Items are converted when they are
+ * accessed, not when the proxy is made.  Assignment and delete change the
+ * List or Dictionary.  The private data is the item in sm_pin which keeps
+ * a reference to it.
+ */
+static JSObject *sm_proxy_new(JSContext *cx, typval_T *tv, JSClass *clasp, JSObject *proto);
+static void sm_proxy_finalize(JSContext *cx, JSObject *obj);
+static JSBool sm_vimlist_get(JSContext *cx, JSObject *obj, jsval id, jsval *vp);
+static JSBool sm_vimlist_set(JSContext *cx, JSObject *obj, jsval id, jsval *vp);
+static JSBool sm_vimlist_del(JSContext *cx, JSObject *obj, jsval id, jsval *vp);
+static JSBool sm_vimlist_enumerate(JSContext *cx, JSObject *obj);
+static JSBool sm_vimlist_resolve(JSContext *cx, JSObject *obj, jsval id);
+static JSBool sm_vimdict_get(JSContext *cx, JSObject *obj, jsval id, jsval *vp);
+static JSBool sm_vimdict_set(JSContext *cx, JSObject *obj, jsval id, jsval *vp);
+static JSBool sm_vimdict_del(JSContext *cx, JSObject *obj, jsval id, jsval *vp);
+static JSBool sm_vimdict_enumerate(JSContext *cx, JSObject *obj);
+static JSBool sm_vimdict_resolve(JSContext *cx, JSObject *obj, jsval id);
+
+static JSClass sm_vimlist_class = {
+  "VimList", JSCLASS_HAS_PRIVATE,
+  JS_PropertyStub, sm_vimlist_del, sm_vimlist_get, sm_vimlist_set,
+  sm_vimlist_enumerate, sm_vimlist_resolve, JS_ConvertStub, sm_proxy_finalize,
+  JSCLASS_NO_OPTIONAL_MEMBERS
+};
+
+static JSClass sm_vimdict_class = {
+  "VimDict", JSCLASS_HAS_PRIVATE,
+  JS_PropertyStub, sm_vimdict_del, sm_vimdict_get, sm_vimdict_set,
+  sm_vimdict_enumerate, sm_vimdict_resolve, JS_ConvertStub, sm_proxy_finalize,
+  JSCLASS_NO_OPTIONAL_MEMBERS
+};
+
+static jsval vim_to_spidermonkey(JSContext *cx, typval_T *tv);
+static JSBool spidermonkey_to_vim(JSContext *cx, jsval v, typval_T *tv, int depth);
 static void execute_file(const char *name);
 static void execute_string(const char *expr);
 
@@ -289,12 +388,38 @@ init(const char *dll_path)
 const char *
 execute(const char *expr)
 {
-  if (vim.eval_expr == NULL)
+  if (vim.eval_expr == NULL || sm_cx == NULL)
     return "not initialized";
   execute_string(expr);
   return NULL;
 }
 
+const char *
+uninit(const char *dummy)
+{
+  if (sm_cx == NULL)
+    return NULL;
+  JS_RemoveRoot(sm_cx, &sm_array_proto);
+  for (int i = 0; i < SCRIPT_CACHE_SIZE; ++i) {
+    JS_RemoveRoot(sm_cx, &sm_script_cache[i].obj);
+    sm_script_cache[i].obj = NULL;
+    sm_script_cache[i].source.clear();
+  }
+  // the last GC finalizes all proxies, which unlink from sm_pin
+  JS_DestroyContext(sm_cx);
+  JS_DestroyRuntime(sm_rt);
+  JS_ShutDown();
+  sm_cx = NULL;
+  sm_rt = NULL;
+  sm_global = NULL;
+  sm_array_proto = NULL;
+
+  vim.do_cmdline_cmd((char_u *)"unlockvar g:__if_spidermonkey_pin");
+  vim.list_unref(sm_pin);
+  sm_pin = NULL;
+  return NULL;
+}
+
 #define GETSYMBOL(name)                           \
   do {                                            \
     void **p = (void **)&vim.name;                \
@@ -317,6 +442,47 @@ init_vim()
   GETSYMBOL(update_screen);
   GETSYMBOL(msg);
   GETSYMBOL(emsg);
+  GETSYMBOL(alloc);
+  GETSYMBOL(vim_free);
+  GETSYMBOL(clear_tv);
+  GETSYMBOL(list_unref);
+  GETSYMBOL(vim_strsave);
+  GETSYMBOL(list_alloc);
+  GETSYMBOL(dict_alloc);
+  GETSYMBOL(listitem_remove);
+  GETSYMBOL(dictitem_alloc);
+  GETSYMBOL(dictitem_free);
+  GETSYMBOL(dict_add);
+  GETSYMBOL(hash_find);
+  GETSYMBOL(hash_remove);
+  GETSYMBOL(list_append);
+  GETSYMBOL(list_find);
+  GETSYMBOL(dict_find);
+
+  // Locked so that it is not unlet or reassigned.  The reference keeps
+  // sm_pin valid even if it is unlocked and unlet anyway.
+  vim.do_cmdline_cmd((char_u *)"let g:__if_spidermonkey_pin = []");
+  vim.do_cmdline_cmd((char_u *)"lockvar 1 g:__if_spidermonkey_pin");
+  typval_T *tv = vim.eval_expr((char_u *)"g:__if_spidermonkey_pin", NULL);
+  if (tv == NULL || tv->v_type != VAR_LIST)
+    return "cannot create g:__if_spidermonkey_pin";
+  sm_pin = tv->vval.v_list;
+  ++sm_pin->lv_refcount;
+  vim.free_tv(tv);
+
+  tv = vim.eval_expr((char_u *)"get(g:, 'if_spidermonkey_cachedir', expand('~/.cache/if_spidermonkey'))", NULL);
+  if (tv != NULL) {
+    if (tv->v_type == VAR_STRING && tv->vval.v_string != NULL)
+      sm_cache_dir = (char *)tv->vval.v_string;
+    vim.free_tv(tv);
+  }
+  // mkdir -p
+  for (size_t i = 1; i <= sm_cache_dir.size(); ++i)
+    if (i == sm_cache_dir.size() || sm_cache_dir[i] == '/')
+      mkdir(sm_cache_dir.substr(0, i).c_str(), 0755);
+  struct stat st;
+  if (!sm_cache_dir.empty() && (stat(sm_cache_dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)))
+    sm_cache_dir.clear();
   return NULL;
 }
 
@@ -355,6 +521,19 @@ init_spidermonkey()
   if (!sm_vim_init(cx, global))
     return "sm_vim_init() error";
 
+  // VimList inherits Array.prototype, whose methods are generic.
+  jsval v;
+  if (!JS_GetProperty(cx, global, "Array", &v) || !JSVAL_IS_OBJECT(v)
+      || !JS_GetProperty(cx, JSVAL_TO_OBJECT(v), "prototype", &v) || !JSVAL_IS_OBJECT(v))
+    return "cannot get Array.prototype";
+  sm_array_proto = JSVAL_TO_OBJECT(v);
+  if (!JS_AddRoot(cx, &sm_array_proto))
+    return "JS_AddRoot() error";
+
+  for (int i = 0; i < SCRIPT_CACHE_SIZE; ++i)
+    if (!JS_AddNamedRoot(cx, &sm_script_cache[i].obj, "if_spidermonkey script cache"))
+      return "JS_AddNamedRoot() error";
+
   sm_rt = rt;
   sm_cx = cx;
   sm_global = global;
@@ -430,9 +609,9 @@ sm_vim_eval(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval)
   if (!JS_ConvertArguments(cx, argc, argv, "s", &str))
     return JS_FALSE;
   typval_T *tv = vim.eval_expr((char_u *)str, NULL);
-  LookupMap lookup_map;
-  *rval = vim_to_spidermonkey(cx, tv, 1, &lookup_map);
-  lookup_map.clear();
+  *rval = vim_to_spidermonkey(cx, tv);
+  if (tv != NULL)
+    vim.free_tv(tv);
   return JS_TRUE;
 }
 
@@ -448,14 +627,288 @@ sm_vim_execute(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rva
 }
 
 
+static JSObject *
+sm_proxy_new(JSContext *cx, typval_T *tv, JSClass *clasp, JSObject *proto)
+{
+  // v_list and v_dict share the union; either is the key.
+  ProxyMap::iterator it = sm_proxies.find(tv->vval.v_list);
+  if (it != sm_proxies.end())
+    return it->second;
+  JSObject *obj = JS_NewObject(cx, clasp, proto, NULL);
+  if (obj == NULL)
+    return NULL;
+  listitem_T *li = (listitem_T *)vim.alloc(sizeof(listitem_T));
+  if (li == NULL) {
+    JS_ReportOutOfMemory(cx);
+    return NULL;
+  }
+  li->li_tv = *tv;
+  if (tv->v_type == VAR_LIST)
+    ++tv->vval.v_list->lv_refcount;
+  else
+    ++tv->vval.v_dict->dv_refcount;
+  vim.list_append(sm_pin, li);
+  JS_SetPrivate(cx, obj, li);
+  sm_proxies[tv->vval.v_list] = obj;
+  return obj;
+}
+
+static void
+sm_proxy_finalize(JSContext *cx, JSObject *obj)
+{
+  listitem_T *li = (listitem_T *)JS_GetPrivate(cx, obj);
+  if (li == NULL)
+    return;
+  sm_proxies.erase(li->li_tv.vval.v_list);
+  // unlink from sm_pin.  Nobody watches it.
+  if (li->li_prev == NULL)
+    sm_pin->lv_first = li->li_next;
+  else
+    li->li_prev->li_next = li->li_next;
+  if (li->li_next == NULL)
+    sm_pin->lv_last = li->li_prev;
+  else
+    li->li_next->li_prev = li->li_prev;
+  --sm_pin->lv_len;
+  sm_pin->lv_idx_item = NULL;
+  vim.clear_tv(&li->li_tv);
+  vim.vim_free(li);
+}
+
+static list_T *
+sm_vimlist_list(JSContext *cx, JSObject *obj)
+{
+  listitem_T *li = (listitem_T *)JS_GetPrivate(cx, obj);
+  return (li == NULL) ? NULL : li->li_tv.vval.v_list;
+}
+
+static JSBool
+sm_vimlist_get(JSContext *cx, JSObject *obj, jsval id, jsval *vp)
+{
+  list_T *list = sm_vimlist_list(cx, obj);
+  if (list == NULL)
+    return JS_TRUE;
+  if (JSVAL_IS_INT(id)) {
+    if (JSVAL_TO_INT(id) < 0)
+      return JS_TRUE;
+    listitem_T *li = vim.list_find(list, JSVAL_TO_INT(id));
+    *vp = (li == NULL) ? JSVAL_VOID : vim_to_spidermonkey(cx, &li->li_tv);
+  } else if (JSVAL_IS_STRING(id)
+      && strcmp(JS_GetStringBytes(JSVAL_TO_STRING(id)), "length") == 0) {
+    *vp = INT_TO_JSVAL(list->lv_len);
+  }
+  return JS_TRUE;
+}
+
+// list[n] = v replaces an item, list[list.length] = v appends one.
+// Setting length truncates the list.
+static JSBool
+sm_vimlist_set(JSContext *cx, JSObject *obj, jsval id, jsval *vp)
+{
+  list_T *list = sm_vimlist_list(cx, obj);
+  if (list == NULL)
+    return JS_TRUE;
+  if (JSVAL_IS_INT(id) && JSVAL_TO_INT(id) >= 0) {
+    long n = JSVAL_TO_INT(id);
+    typval_T tv;
+    if (!spidermonkey_to_vim(cx, *vp, &tv, 1))
+      return JS_FALSE;
+    // look up after the conversion.  A getter may change the list.
+    listitem_T *li = vim.list_find(list, n);
+    if (li != NULL) {
+      vim.clear_tv(&li->li_tv);
+      li->li_tv = tv;
+    } else if (n == list->lv_len && (li = (listitem_T *)vim.alloc(sizeof(listitem_T))) != NULL) {
+      li->li_tv = tv;
+      vim.list_append(list, li);
+    } else {
+      vim.clear_tv(&tv);
+      JS_ReportError(cx, "list index out of range");
+      return JS_FALSE;
+    }
+  } else if (JSVAL_IS_STRING(id)
+      && strcmp(JS_GetStringBytes(JSVAL_TO_STRING(id)), "length") == 0) {
+    if (!JSVAL_IS_INT(*vp) || JSVAL_TO_INT(*vp) < 0 || JSVAL_TO_INT(*vp) > list->lv_len) {
+      JS_ReportError(cx, "invalid list length");
+      return JS_FALSE;
+    }
+    while (list->lv_len > JSVAL_TO_INT(*vp))
+      vim.listitem_remove(list, list->lv_last);
+  }
+  return JS_TRUE;
+}
+
+static JSBool
+sm_vimlist_del(JSContext *cx, JSObject *obj, jsval id, jsval *vp)
+{
+  list_T *list = sm_vimlist_list(cx, obj);
+  if (list == NULL || !JSVAL_IS_INT(id) || JSVAL_TO_INT(id) < 0)
+    return JS_TRUE;
+  listitem_T *li = vim.list_find(list, JSVAL_TO_INT(id));
+  if (li != NULL)
+    vim.listitem_remove(list, li);
+  return JS_TRUE;
+}
+
+static JSBool
+sm_vimlist_enumerate(JSContext *cx, JSObject *obj)
+{
+  list_T *list = sm_vimlist_list(cx, obj);
+  if (list == NULL)
+    return JS_TRUE;
+  for (int i = 0; i < list->lv_len; ++i)
+    if (!JS_DefineElement(cx, obj, i, JSVAL_VOID, NULL, NULL, JSPROP_ENUMERATE | JSPROP_SHARED))
+      return JS_FALSE;
+  return JS_TRUE;
+}
+
+static JSBool
+sm_vimlist_resolve(JSContext *cx, JSObject *obj, jsval id)
+{
+  list_T *list = sm_vimlist_list(cx, obj);
+  if (list == NULL)
+    return JS_TRUE;
+  if (JSVAL_IS_INT(id)) {
+    if (JSVAL_TO_INT(id) >= 0 && JSVAL_TO_INT(id) < list->lv_len)
+      return JS_DefineElement(cx, obj, JSVAL_TO_INT(id), JSVAL_VOID, NULL, NULL, JSPROP_ENUMERATE | JSPROP_SHARED);
+  } else if (JSVAL_IS_STRING(id)
+      && strcmp(JS_GetStringBytes(JSVAL_TO_STRING(id)), "length") == 0) {
+    return JS_DefineProperty(cx, obj, "length", JSVAL_VOID, NULL, NULL, JSPROP_SHARED | JSPROP_PERMANENT);
+  }
+  return JS_TRUE;
+}
+
+static dict_T *
+sm_vimdict_dict(JSContext *cx, JSObject *obj)
+{
+  listitem_T *li = (listitem_T *)JS_GetPrivate(cx, obj);
+  return (li == NULL) ? NULL : li->li_tv.vval.v_dict;
+}
+
+// Dictionary key of property id.  Integer id is used as "123".
+static bool
+sm_vimdict_key(jsval id, std::string *key)
+{
+  if (JSVAL_IS_INT(id)) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%ld", (long)JSVAL_TO_INT(id));
+    *key = buf;
+  } else if (JSVAL_IS_STRING(id)) {
+    *key = JS_GetStringBytes(JSVAL_TO_STRING(id));
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Returns the dict item for property id.
+static dictitem_T *
+sm_vimdict_find(JSContext *cx, dict_T *dict, jsval id)
+{
+  std::string key;
+  if (!sm_vimdict_key(id, &key))
+    return NULL;
+  return vim.dict_find(dict, (char_u *)key.c_str(), -1);
+}
+
+static JSBool
+sm_vimdict_get(JSContext *cx, JSObject *obj, jsval id, jsval *vp)
+{
+  dict_T *dict = sm_vimdict_dict(cx, obj);
+  if (dict == NULL)
+    return JS_TRUE;
+  dictitem_T *di = sm_vimdict_find(cx, dict, id);
+  *vp = (di == NULL) ? JSVAL_VOID : vim_to_spidermonkey(cx, &di->di_tv);
+  return JS_TRUE;
+}
+
+static JSBool
+sm_vimdict_set(JSContext *cx, JSObject *obj, jsval id, jsval *vp)
+{
+  dict_T *dict = sm_vimdict_dict(cx, obj);
+  std::string key;
+  if (dict == NULL || !sm_vimdict_key(id, &key))
+    return JS_TRUE;
+  if (key.empty()) {
+    JS_ReportError(cx, "empty key for Dictionary");
+    return JS_FALSE;
+  }
+  typval_T tv;
+  if (!spidermonkey_to_vim(cx, *vp, &tv, 1))
+    return JS_FALSE;
+  // look up after the conversion.  A getter may change the dict.
+  dictitem_T *di = vim.dict_find(dict, (char_u *)key.c_str(), -1);
+  if (di != NULL) {
+    vim.clear_tv(&di->di_tv);
+    di->di_tv = tv;
+    return JS_TRUE;
+  }
+  di = vim.dictitem_alloc((char_u *)key.c_str());
+  if (di == NULL) {
+    vim.clear_tv(&tv);
+    JS_ReportOutOfMemory(cx);
+    return JS_FALSE;
+  }
+  di->di_tv = tv;
+  if (vim.dict_add(dict, di) == FAIL) {
+    vim.dictitem_free(di);
+    JS_ReportOutOfMemory(cx);
+    return JS_FALSE;
+  }
+  return JS_TRUE;
+}
+
+static JSBool
+sm_vimdict_del(JSContext *cx, JSObject *obj, jsval id, jsval *vp)
+{
+  dict_T *dict = sm_vimdict_dict(cx, obj);
+  if (dict == NULL)
+    return JS_TRUE;
+  dictitem_T *di = sm_vimdict_find(cx, dict, id);
+  if (di == NULL)
+    return JS_TRUE;
+  vim.hash_remove(&dict->dv_hashtab, vim.hash_find(&dict->dv_hashtab, di->di_key));
+  vim.dictitem_free(di);
+  return JS_TRUE;
+}
+
+static JSBool
+sm_vimdict_enumerate(JSContext *cx, JSObject *obj)
+{
+  dict_T *dict = sm_vimdict_dict(cx, obj);
+  if (dict == NULL)
+    return JS_TRUE;
+  hashtab_T *ht = &dict->dv_hashtab;
+  long_u todo = ht->ht_used;
+  for (hashitem_T *hi = ht->ht_array; todo > 0; ++hi) {
+    if (!HASHITEM_EMPTY(hi)) {
+      --todo;
+      if (!JS_DefineProperty(cx, obj, (char *)hi->hi_key, JSVAL_VOID, NULL, NULL, JSPROP_ENUMERATE | JSPROP_SHARED))
+        return JS_FALSE;
+    }
+  }
+  return JS_TRUE;
+}
+
+static JSBool
+sm_vimdict_resolve(JSContext *cx, JSObject *obj, jsval id)
+{
+  dict_T *dict = sm_vimdict_dict(cx, obj);
+  if (dict == NULL)
+    return JS_TRUE;
+  dictitem_T *di = sm_vimdict_find(cx, dict, id);
+  if (di == NULL)
+    return JS_TRUE;
+  if (JSVAL_IS_INT(id))
+    return JS_DefineElement(cx, obj, JSVAL_TO_INT(id), JSVAL_VOID, NULL, NULL, JSPROP_ENUMERATE | JSPROP_SHARED);
+  return JS_DefineProperty(cx, obj, (char *)di->di_key, JSVAL_VOID, NULL, NULL, JSPROP_ENUMERATE | JSPROP_SHARED);
+}
+
 static jsval
-vim_to_spidermonkey(JSContext *cx, typval_T *tv, int depth, LookupMap *lookup_map)
+vim_to_spidermonkey(JSContext *cx, typval_T *tv)
 {
-  if (tv == NULL || depth > 100)
+  if (tv == NULL)
     return JSVAL_VOID;
-  LookupMap::iterator it = lookup_map->find(tv);
-  if (it != lookup_map->end())
-    return it->second;
   switch (tv->v_type) {
   case VAR_NUMBER:
     return INT_TO_JSVAL(tv->vval.v_number);
@@ -467,35 +920,17 @@ vim_to_spidermonkey(JSContext *cx, typval_T *tv, int depth, LookupMap *lookup_ma
     return STRING_TO_JSVAL(JS_NewStringCopyZ(cx, "[function]"));
   case VAR_LIST:
     {
-      list_T *list = tv->vval.v_list;
-      if (list == NULL)
+      if (tv->vval.v_list == NULL)
         return JSVAL_VOID;
-      int i = 0;
-      JSObject *res = JS_NewArrayObject(cx, 0, NULL);
-      for (listitem_T *curr = list->lv_first; curr != NULL; curr = curr->li_next) {
-        jsval v = vim_to_spidermonkey(cx, &curr->li_tv, depth + 1, lookup_map);
-        JS_SetElement(cx, res, INT_TO_JSVAL(i++), &v);
-      }
-      lookup_map->insert(LookupMap::value_type(tv, OBJECT_TO_JSVAL(res)));
-      return OBJECT_TO_JSVAL(res);
+      JSObject *res = sm_proxy_new(cx, tv, &sm_vimlist_class, sm_array_proto);
+      return (res == NULL) ? JSVAL_VOID : OBJECT_TO_JSVAL(res);
     }
   case VAR_DICT:
     {
-      hashtab_T *ht = &tv->vval.v_dict->dv_hashtab;
-      long_u todo = ht->ht_used;
-      hashitem_T *hi;
-      dictitem_T *di;
-      JSObject *res = JS_NewObject(cx, NULL, NULL, NULL);
-      for (hi = ht->ht_array; todo > 0; ++hi) {
-        if (!HASHITEM_EMPTY(hi)) {
-          --todo;
-          di = HI2DI(hi);
-          jsval v = vim_to_spidermonkey(cx, &di->di_tv, depth + 1, lookup_map);
-          JS_SetProperty(cx, res, (char *)hi->hi_key, &v);
-        }
-      }
-      lookup_map->insert(LookupMap::value_type(tv, OBJECT_TO_JSVAL(res)));
-      return OBJECT_TO_JSVAL(res);
+      if (tv->vval.v_dict == NULL)
+        return JSVAL_VOID;
+      JSObject *res = sm_proxy_new(cx, tv, &sm_vimdict_class, NULL);
+      return (res == NULL) ? JSVAL_VOID : OBJECT_TO_JSVAL(res);
     }
   case VAR_UNKNOWN:
   default:
@@ -503,11 +938,314 @@ vim_to_spidermonkey(JSContext *cx, typval_T *tv, int depth, LookupMap *lookup_ma
   }
 }
 
+// Lists and Dictionaries from proxies are shared, others are copied.
+static JSBool
+spidermonkey_to_vim(JSContext *cx, jsval v, typval_T *tv, int depth)
+{
+  tv->v_lock = 0;
+  if (depth > 100) {
+    JS_ReportError(cx, "spidermonkey_to_vim(): too deep");
+    return JS_FALSE;
+  }
+  if (JSVAL_IS_INT(v)) {
+    tv->v_type = VAR_NUMBER;
+    tv->vval.v_number = JSVAL_TO_INT(v);
+    return JS_TRUE;
+  }
+  if (JSVAL_IS_DOUBLE(v)) {
+    tv->v_type = VAR_FLOAT;
+    tv->vval.v_float = *JSVAL_TO_DOUBLE(v);
+    return JS_TRUE;
+  }
+  if (JSVAL_IS_BOOLEAN(v) || JSVAL_IS_NULL(v) || JSVAL_IS_VOID(v)) {
+    tv->v_type = VAR_NUMBER;
+    tv->vval.v_number = JSVAL_IS_BOOLEAN(v) ? JSVAL_TO_BOOLEAN(v) : 0;
+    return JS_TRUE;
+  }
+  if (JSVAL_IS_STRING(v)) {
+    tv->v_type = VAR_STRING;
+    tv->vval.v_string = vim.vim_strsave((char_u *)JS_GetStringBytes(JSVAL_TO_STRING(v)));
+    return JS_TRUE;
+  }
+
+  JSObject *obj = JSVAL_TO_OBJECT(v);
+  JSClass *clasp = JS_GET_CLASS(cx, obj);
+  if (clasp == &sm_vimlist_class || clasp == &sm_vimdict_class) {
+    listitem_T *li = (listitem_T *)JS_GetPrivate(cx, obj);
+    if (li == NULL) {
+      JS_ReportError(cx, "spidermonkey_to_vim(): invalid %s", clasp->name);
+      return JS_FALSE;
+    }
+    *tv = li->li_tv;
+    if (tv->v_type == VAR_LIST)
+      ++tv->vval.v_list->lv_refcount;
+    else
+      ++tv->vval.v_dict->dv_refcount;
+    return JS_TRUE;
+  }
+  if (JS_ObjectIsFunction(cx, obj)) {
+    JS_ReportError(cx, "spidermonkey_to_vim(): cannot convert function");
+    return JS_FALSE;
+  }
+
+  if (JS_IsArrayObject(cx, obj)) {
+    list_T *list = vim.list_alloc();
+    if (list == NULL) {
+      JS_ReportOutOfMemory(cx);
+      return JS_FALSE;
+    }
+    tv->v_type = VAR_LIST;
+    tv->vval.v_list = list;
+    ++list->lv_refcount;
+    jsuint len;
+    if (!JS_GetArrayLength(cx, obj, &len)) {
+      vim.clear_tv(tv);
+      return JS_FALSE;
+    }
+    for (jsuint i = 0; i < len; ++i) {
+      jsval e;
+      listitem_T *li;
+      if (!JS_GetElement(cx, obj, i, &e)
+          || (li = (listitem_T *)vim.alloc(sizeof(listitem_T))) == NULL) {
+        vim.clear_tv(tv);
+        return JS_FALSE;
+      }
+      if (!spidermonkey_to_vim(cx, e, &li->li_tv, depth + 1)) {
+        vim.vim_free(li);
+        vim.clear_tv(tv);
+        return JS_FALSE;
+      }
+      vim.list_append(list, li);
+    }
+    return JS_TRUE;
+  }
+
+  dict_T *dict = vim.dict_alloc();
+  if (dict == NULL) {
+    JS_ReportOutOfMemory(cx);
+    return JS_FALSE;
+  }
+  tv->v_type = VAR_DICT;
+  tv->vval.v_dict = dict;
+  ++dict->dv_refcount;
+  JSIdArray *ids = JS_Enumerate(cx, obj);
+  if (ids == NULL) {
+    vim.clear_tv(tv);
+    return JS_FALSE;
+  }
+  JSBool ok = JS_TRUE;
+  for (jsint i = 0; ok && i < ids->length; ++i) {
+    jsval id;
+    std::string key;
+    jsval e;
+    typval_T item;
+    ok = JS_IdToValue(cx, ids->vector[i], &id);
+    if (!ok || !sm_vimdict_key(id, &key) || key.empty())
+      continue;
+    ok = JS_GetProperty(cx, obj, key.c_str(), &e)
+      && spidermonkey_to_vim(cx, e, &item, depth + 1);
+    if (!ok)
+      break;
+    dictitem_T *di = vim.dictitem_alloc((char_u *)key.c_str());
+    if (di == NULL) {
+      vim.clear_tv(&item);
+      ok = JS_FALSE;
+      break;
+    }
+    di->di_tv = item;
+    if (vim.dict_add(dict, di) == FAIL) {
+      vim.dictitem_free(di);
+      ok = JS_FALSE;
+    }
+  }
+  JS_DestroyIdArray(cx, ids);
+  if (!ok)
+    vim.clear_tv(tv);
+  return ok;
+}
+
+static unsigned long
+hash_string(const char *s)
+{
+  // FNV-1a
+  unsigned long h = 2166136261UL;
+  for (; *s != '\0'; ++s)
+    h = (h ^ (unsigned char)*s) * 16777619UL;
+  return h;
+}
+
+/*
+ * FNV-1a of the file contents.  mtime has only whole seconds, and a quick
+ * fix often keeps the size, so the contents identify the source.
+ */
+static bool
+hash_file(const char *name, unsigned long *hash)
+{
+  FILE *file = fopen(name, "rb");
+  if (file == NULL)
+    return false;
+  unsigned long h = 2166136261UL;
+  char chunk[8192];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    for (size_t i = 0; i < n; ++i)
+      h = (h ^ (unsigned char)chunk[i]) * 16777619UL;
+  bool ok = !ferror(file);
+  fclose(file);
+  *hash = h;
+  return ok;
+}
+
+/*
+ * Cache file is named after the script path.  The header identifies the
+ * file and the engine the data was produced for; anything else is stale.
+ *   "if_spidermonkey script cache\n" <version> "\n" <path> "\n"
+ *   <content hash> <size> "\n" <data length> "\n" <data>
+ */
+static std::string
+script_cache_header(const char *name)
+{
+  struct stat st;
+  unsigned long hash;
+  if (stat(name, &st) != 0 || !hash_file(name, &hash))
+    return "";
+  char hex[32];
+  snprintf(hex, sizeof(hex), "%08lx", hash);
+  std::ostringstream s;
+  s << "if_spidermonkey script cache\n" << JS_GetImplementationVersion();
+#ifdef JSXDR_BYTECODE_VERSION
+  s << " " << JSXDR_BYTECODE_VERSION;
+#endif
+  s << "\n" << name << "\n" << hex << " " << (long)st.st_size << "\n";
+  return s.str();
+}
+
+static std::string
+script_cache_path(const char *name)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%08lx.xdr", hash_string(name));
+  return sm_cache_dir + "/" + buf;
+}
+
+/* Returns NULL when there is no usable cache. */
+static JSScript *
+read_script_cache(const std::string& path, const std::string& header)
+{
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == NULL)
+    return NULL;
+  std::string buf;
+  char chunk[8192];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    buf.append(chunk, n);
+  fclose(file);
+  if (buf.compare(0, header.size(), header) != 0)
+    return NULL;
+  size_t pos = buf.find('\n', header.size());
+  if (pos == std::string::npos)
+    return NULL;
+  unsigned long len = strtoul(buf.c_str() + header.size(), NULL, 10);
+  if (len == 0 || len != buf.size() - pos - 1)
+    return NULL;
+
+  JSXDRState *xdr = JS_XDRNewMem(sm_cx, JSXDR_DECODE);
+  if (xdr == NULL)
+    return NULL;
+  JS_XDRMemSetData(xdr, &buf[pos + 1], len);
+  JSScript *script = NULL;
+  // broken data falls back to compiling without an error message
+  JSErrorReporter reporter = JS_SetErrorReporter(sm_cx, NULL);
+  if (!JS_XDRScript(xdr, &script))
+    script = NULL;
+  JS_SetErrorReporter(sm_cx, reporter);
+  JS_ClearPendingException(sm_cx);
+  // buf is not owned by xdr
+  JS_XDRMemSetData(xdr, NULL, 0);
+  JS_XDRDestroy(xdr);
+  return script;
+}
+
+static void
+write_script_cache(const std::string& path, const std::string& header, JSScript *script)
+{
+  JSXDRState *xdr = JS_XDRNewMem(sm_cx, JSXDR_ENCODE);
+  if (xdr == NULL)
+    return;
+  uint32 len = 0;
+  void *data = NULL;
+  if (JS_XDRScript(xdr, &script))
+    data = JS_XDRMemGetData(xdr, &len);
+  if (data != NULL && len > 0) {
+    std::string tmp = path + ".tmp";
+    FILE *file = fopen(tmp.c_str(), "wb");
+    if (file != NULL) {
+      std::ostringstream s;
+      s << header << len << "\n";
+      std::string head = s.str();
+      bool ok = fwrite(head.data(), 1, head.size(), file) == head.size()
+        && fwrite(data, 1, len, file) == len;
+      if (fclose(file) != 0)
+        ok = false;
+      if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+        remove(tmp.c_str());
+    }
+  }
+  JS_XDRDestroy(xdr);
+}
+
+static JSScript *
+compile_file(const char *name)
+{
+  if (sm_cache_dir.empty())
+    return JS_CompileFile(sm_cx, sm_global, name);
+  std::string header = script_cache_header(name);
+  if (header.empty())
+    return JS_CompileFile(sm_cx, sm_global, name);
+  std::string path = script_cache_path(name);
+  JSScript *script = read_script_cache(path, header);
+  if (script != NULL)
+    return script;
+  script = JS_CompileFile(sm_cx, sm_global, name);
+  if (script != NULL)
+    write_script_cache(path, header, script);
+  return script;
+}
+
+/*
+ * Returns the script object of expr from sm_script_cache, compiling it
+ * when not found.  The script is owned by the object.
+ */
+static JSObject *
+compile_string(const char *expr)
+{
+  for (int i = 0; i < SCRIPT_CACHE_SIZE; ++i) {
+    if (sm_script_cache[i].obj != NULL && sm_script_cache[i].source == expr) {
+      std::rotate(sm_script_cache, sm_script_cache + i, sm_script_cache + i + 1);
+      return sm_script_cache[0].obj;
+    }
+  }
+  JSScript *script = JS_CompileScript(sm_cx, sm_global, expr, strlen(expr), NULL, 0);
+  if (script == NULL)
+    return NULL;
+  JSObject *obj = JS_NewScriptObject(sm_cx, script);
+  if (obj == NULL) {
+    JS_DestroyScript(sm_cx, script);
+    return NULL;
+  }
+  // the last entry is dropped; its object is collected by the next GC
+  std::rotate(sm_script_cache, sm_script_cache + SCRIPT_CACHE_SIZE - 1, sm_script_cache + SCRIPT_CACHE_SIZE);
+  sm_script_cache[0].source = expr;
+  sm_script_cache[0].obj = obj;
+  return obj;
+}
+
 static void
 execute_file(const char *name)
 {
   JS_ClearPendingException(sm_cx);
-  JSScript *script = JS_CompileFile(sm_cx, sm_global, name);
+  JSScript *script = compile_file(name);
   if (script == NULL) {
     JS_ReportError(sm_cx, "compile error");
     return;
@@ -523,14 +1261,17 @@ static void
 execute_string(const char *expr)
 {
   JS_ClearPendingException(sm_cx);
-  JSScript *script = JS_CompileScript(sm_cx, sm_global, expr, strlen(expr), NULL, 0);
-  if (script == NULL) {
+  JSObject *obj = compile_string(expr);
+  if (obj == NULL) {
     JS_ReportError(sm_cx, "compile error");
     return;
   }
+  // keep the script alive even if a nested execute() evicts it
+  if (!JS_AddNamedRoot(sm_cx, &obj, "execute_string"))
+    return;
   jsval result;
-  JSBool ok = JS_ExecuteScript(sm_cx, sm_global, script, &result);
-  JS_DestroyScript(sm_cx, script);
+  JSBool ok = JS_ExecuteScript(sm_cx, sm_global, (JSScript *)JS_GetPrivate(sm_cx, obj), &result);
+  JS_RemoveRoot(sm_cx, &obj);
   if (ok == JS_FALSE)
     JS_ReportError(sm_cx, "execute error");
 }
@@ -13,6 +13,23 @@ for (var key in dict) {
   print(key + " = " + dict[key]);
 }
 
+var nested = vim.eval('nested');
+print('nested.list.length = ' + nested.list.length);
+print('nested.list[1].x = ' + nested.list[1].x);
+print('nested.list[0].join() = ' + nested.list[0].join('-'));
+print('nested[10] = ' + nested[10]);
+print('nested.self === nested: ' + (nested.self === nested));
+print('"list" in nested: ' + ('list' in nested) + ', "none" in nested: ' + ('none' in nested));
+vim.execute("call add(nested.list[0], 3)");
+print('nested.list[0] after add = ' + nested.list[0].join('-'));
+nested.list[0].push(4);
+nested.list[0][0] = 0;
+print('after push = ' + vim.eval('join(nested.list[0], "-")'));
+nested.y = {a: [1, 2.5], b: 'bbb'};
+print('nested.y = ' + vim.eval('string(nested.y)'));
+delete nested.y;
+print('has_key(nested, "y") = ' + vim.eval('has_key(nested, "y")'));
+
 vim.execute("new");
 vim.eval('append("$", "line1")');
 vim.eval('append("$", "line2")');
@@ -1,5 +1,7 @@
 let arr = [1, 2, 3, 4, 5]
 let dict = {'a':'aaa', 'b':'bbb', 'c':'ccc'}
+let nested = {'list': [[1, 2], {'x': 'deep'}], '10': 'ten'}
+let nested.self = nested
 
 let if_spidermonkey = './if_spidermonkey.so'
 echo libcall(if_spidermonkey, 'init', if_spidermonkey)
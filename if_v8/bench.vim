@@ -0,0 +1,160 @@
+so <sfile>:p:h/init.vim
+
+" usage: vim -u NONE -S bench.vim
+
+function! s:Report(name, start, n)
+  let sec = str2float(reltimestr(reltime(a:start)))
+  echo printf("%s: %.3f sec (%.2f usec/op)", a:name, sec, sec * 1000000.0 / a:n)
+endfunction
+
+let s:bench = {}
+
+" bench1: wrap 100k lists and look them up in objcache
+function s:bench.bench1()
+  let g:__if_v8_bench = map(range(100000), '[v:val]')
+  let start = reltime()
+  V8Start
+  V8 var lists = vim.g['__if_v8_bench'];
+  V8 var keep = [];
+  V8 for (var i = 0; i < lists.length; ++i) {
+  V8   keep.push(lists[i]);
+  V8 }
+  V8 for (var i = 0; i < lists.length; ++i) {
+  V8   lists[i];
+  V8 }
+  V8 keep = null;
+  V8End
+  call s:Report("bench1: wrap 100k lists", start, 200000)
+  unlet g:__if_v8_bench
+endfunction
+
+" bench2: call Vim builtin function from JavaScript in a loop
+function s:bench.bench2()
+  let start = reltime()
+  V8Start
+  V8 var printf = vim._function('printf');
+  V8 for (var i = 0; i < 100000; ++i) {
+  V8   printf('%d', i);
+  V8 }
+  V8End
+  call s:Report("bench2: call printf() 100k times", start, 100000)
+endfunction
+
+" bench3: vim.eval()/vim.let() against the :execute + g:__if_v8 path
+function s:bench.bench3()
+  let start = reltime()
+  V8Start
+  V8 for (var i = 0; i < 100000; ++i) {
+  V8   vim.let('g:__if_v8_bench', vim.eval('&textwidth') + i);
+  V8 }
+  V8End
+  call s:Report("bench3: vim.eval()/vim.let() 100k times", start, 100000)
+  let start = reltime()
+  V8Start
+  V8 var reg = vim.g['__if_v8'];
+  V8 for (var i = 0; i < 100000; ++i) {
+  V8   reg['%v8_args%'] = ['&textwidth'];
+  V8   vim.execute("let g:__if_v8['%v8_result%'] = eval(g:__if_v8['%v8_args%'][0])");
+  V8   reg['%v8_args%'] = ['g:__if_v8_bench', reg['%v8_result%'] + i];
+  V8   vim.execute("execute 'let ' . g:__if_v8['%v8_args%'][0] . ' = g:__if_v8[''%v8_args%''][1]'");
+  V8 }
+  V8End
+  call s:Report("bench3: :execute path 100k times", start, 100000)
+  unlet g:__if_v8_bench
+endfunction
+
+" bench4: walk 100k list by index and by iterator
+function s:bench.bench4()
+  let g:__if_v8_bench = range(100000)
+  let start = reltime()
+  V8Start
+  V8 var list = vim.g['__if_v8_bench'];
+  V8 var sum = 0;
+  V8 for (var i = 0; i < list.length; ++i) {
+  V8   sum += list[i];
+  V8 }
+  V8End
+  call s:Report("bench4: index 100k list", start, 100000)
+  let start = reltime()
+  V8Start
+  V8 var it = vim.List.iterator(vim.g['__if_v8_bench']);
+  V8 var sum = 0;
+  V8 for (var r = it.next(); !r.done; r = it.next()) {
+  V8   sum += r.value;
+  V8 }
+  V8End
+  call s:Report("bench4: iterate 100k list", start, 100000)
+  unlet g:__if_v8_bench
+endfunction
+
+" bench5: bulk conversion of 100k list and dict
+function s:bench.bench5()
+  let g:__if_v8_bench = range(100000)
+  let start = reltime()
+  V8Start
+  V8 var arr = vim.ListToArray(vim.g['__if_v8_bench']);
+  V8 var list = vim.ArrayToList(arr);
+  V8 var f64 = vim.ListToArray(list, 'Float64Array');
+  V8End
+  call s:Report("bench5: convert 100k list", start, 300000)
+  let g:__if_v8_bench = {}
+  for i in range(100000)
+    let g:__if_v8_bench['k' . i] = i
+  endfor
+  let start = reltime()
+  V8Start
+  V8 var obj = vim.DictToObject(vim.g['__if_v8_bench']);
+  V8 var dict = vim.ObjectToDict(obj);
+  V8End
+  call s:Report("bench5: convert 100k dict", start, 200000)
+  unlet g:__if_v8_bench
+endfunction
+
+" bench6: pass 4MB string to JavaScript and back
+function s:bench.bench6()
+  let g:__if_v8_bench = repeat('x', 4 * 1024 * 1024)
+  let start = reltime()
+  V8Start
+  V8 var g = vim.g;
+  V8 for (var i = 0; i < 100; ++i) {
+  V8   g['__if_v8_bench'] = g['__if_v8_bench'];
+  V8 }
+  V8End
+  call s:Report("bench6: 4MB string round trip 100 times", start, 100)
+  unlet g:__if_v8_bench
+endfunction
+
+" bench7: read 100k lines buffer
+function s:bench.bench7()
+  new
+  call setline(1, map(range(100000), '"line " . v:val'))
+  let start = reltime()
+  V8Start
+  V8 var lines = vim.buffer().getLines();
+  V8 var n = 0;
+  V8 for (var i = 0; i < lines.length; ++i) {
+  V8   n += lines[i].length;
+  V8 }
+  V8End
+  call s:Report("bench7: getLines() 100k lines", start, 100000)
+  let start = reltime()
+  V8Start
+  V8 var lines = vim.eval('getline(1, "$")');
+  V8 var n = 0;
+  V8 for (var i = 0; i < lines.length; ++i) {
+  V8   n += lines[i].length;
+  V8 }
+  V8End
+  call s:Report("bench7: getline(1, '$') 100k lines", start, 100000)
+  bwipeout!
+endfunction
+
+function! s:mysort(a, b)
+  let a = matchstr(a:a, '\d\+')
+  let b = matchstr(a:b, '\d\+')
+  return a - b
+endfunction
+
+for s:name in sort(keys(s:bench), 's:mysort')
+  call s:bench[s:name]()
+endfor
@@ -0,0 +1,144 @@
+// Conversion benchmarks for fakevim.  See fakevim.cpp.
+//
+// The fixtures g:bench_long, g:bench_deep, g:bench_funcs,
+// g:bench_bigstrings and g:bench_strings are made by fakevim.
+
+var long = vim.g.bench_long;
+var deep = vim.g.bench_deep;
+var funcs = vim.g.bench_funcs;
+var bigstrings = vim.g.bench_bigstrings;
+var strings = vim.g.bench_strings;
+
+var numbers = [];
+for (var i = 0; i < 10000; ++i) {
+  numbers.push(i);
+}
+
+var makeDeep = function(depth) {
+  var obj = {};
+  for (var i = 0; i < 4; ++i) {
+    obj['key' + i] = (depth > 1) ? makeDeep(depth - 1) : i;
+  }
+  return obj;
+};
+var deepobj = makeDeep(6);
+
+// dict_index_set writes here, so that the shared fixtures stay as made.
+var indexdict = new vim.Dict();
+
+var objects = [];
+for (var i = 0; i < 10000; ++i) {
+  objects.push({id: i, name: 'item' + i});
+}
+
+var walk = function(dict) {
+  var n = 0;
+  for (var k in dict) {
+    var v = dict[k];
+    n += (typeof v === 'object') ? walk(v) : 1;
+  }
+  return n;
+};
+
+var bigjs = new Array(65537).join('y');
+
+var deepjson = vim.json.encode(deep);
+
+var benchmarks = {
+  list_index: function() {
+    var sum = 0;
+    for (var i = 0; i < 1000; ++i) {
+      sum += long[i];
+    }
+    return sum;
+  },
+  list_to_array: function() {
+    return vim.ListToArray(long);
+  },
+  list_to_int32array: function() {
+    return vim.ListToArray(long, 'Int32Array');
+  },
+  array_to_list: function() {
+    return vim.ArrayToList(numbers);
+  },
+  dict_named_get: function() {
+    var n = 0;
+    for (var i = 0; i < 1000; ++i) {
+      n += deep.key1.key2.key3.key0.key1.key2;
+    }
+    return n;
+  },
+  dict_index_set: function() {
+    var d = indexdict;
+    for (var i = 0; i < 1000; ++i) {
+      d[i & 15] = i;
+    }
+  },
+  deep_dict_walk: function() {
+    return walk(deep);
+  },
+  objects_to_list: function() {
+    return vim.ArrayToList(objects);
+  },
+  deep_object_to_dict: function() {
+    return vim.ObjectToDict(deepobj);
+  },
+  json_encode: function() {
+    return vim.json.encode(deep);
+  },
+  json_decode: function() {
+    return vim.json.decode(deepjson);
+  },
+  json_stringify_wrapper: function() {
+    return JSON.stringify(vim.DictToObject(deep));
+  },
+  wrapper_new: function() {
+    var l;
+    for (var i = 0; i < 1000; ++i) {
+      l = new vim.List();
+    }
+    return l;
+  },
+  funcref_get: function() {
+    var f;
+    for (var i = 0; i < funcs.length; ++i) {
+      f = funcs[i];
+    }
+    return f;
+  },
+  funcref_call: function() {
+    return funcs[0](numbers);
+  },
+  vim_call: function() {
+    return vim.call('len', ['abc']);
+  },
+  short_string_get: function() {
+    var n = 0;
+    for (var i = 0; i < strings.length; ++i) {
+      n += strings[i].length;
+    }
+    return n;
+  },
+  big_string_get: function() {
+    var n = 0;
+    for (var i = 0; i < bigstrings.length; ++i) {
+      n += bigstrings[i].length;
+    }
+    return n;
+  },
+  big_string_set: function() {
+    vim.g.bench_out = bigjs;
+  },
+  buffer_get_lines: function() {
+    return vim.buffer(1).getLines(1, 1000);
+  }
+};
+
+var __bench_run = function(name, n) {
+  var f = benchmarks[name];
+  for (var i = 0; i < n; ++i) {
+    f();
+  }
+};
+
+vim.g.bench_names = Object.keys(benchmarks);
@@ -0,0 +1,869 @@
+/* vim:set foldmethod=marker:
+ *
+ * Fake Vim for benchmarking if_v8 without Vim.
+ *
+ * This program provides the Vim symbols which if_v8.so imports (just
+ * enough of them to convert List, Dictionary, Funcref and String) and
+ * loads if_v8.so as libcall() does.  Like Vim, it must be linked with
+ * -rdynamic.
+ *
+ * usage: fakevim [-n count] path/to/if_v8.so runtime.js bench_convert.js
+ *
+ * The script defines "benchmarks" (name => function).  Each function is
+ * called "count" times in one execute() and the time, the number of Vim
+ * allocations (alloc()) and the number of C++ allocations (operator new)
+ * per call are reported.
+ */
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "vimext.h"
+
+/* allocation counter {{{1 */
+
+static unsigned long vim_allocs = 0;
+static unsigned long vim_bytes = 0;
+static unsigned long cxx_allocs = 0;
+
+// if_v8.so uses this operator new because the program is linked with
+// -rdynamic.
+void *
+operator new(size_t size)
+{
+  ++cxx_allocs;
+  void *p = malloc(size == 0 ? 1 : size);
+  if (p == NULL)
+    throw std::bad_alloc();
+  return p;
+}
+
+void *
+operator new[](size_t size)
+{
+  ++cxx_allocs;
+  void *p = malloc(size == 0 ? 1 : size);
+  if (p == NULL)
+    throw std::bad_alloc();
+  return p;
+}
+
+void
+operator delete(void *p) throw()
+{
+  free(p);
+}
+
+void
+operator delete[](void *p) throw()
+{
+  free(p);
+}
+
+#if __cplusplus >= 201402L
+void
+operator delete(void *p, size_t size) throw()
+{
+  free(p);
+}
+
+void
+operator delete[](void *p, size_t size) throw()
+{
+  free(p);
+}
+#endif
+
+/* variables {{{1 */
+
+static buf_T fake_buf;
+static std::vector<char_u *> fake_lines;
+static struct msglist *fake_msglist = NULL;
+
+extern "C" {
+
+char_u hash_removed;
+int got_int = FALSE;
+int did_emsg = FALSE;
+int did_throw = FALSE;
+int trylevel = 0;
+except_T *current_exception = NULL;
+struct msglist **msg_list = &fake_msglist;
+buf_T *curbuf = &fake_buf;
+
+}
+
+static dict_T *fake_globvardict;
+static dict_T *fake_vimvardict;
+
+/* memory {{{1 */
+
+extern "C" {
+
+char_u *
+alloc(unsigned size)
+{
+  ++vim_allocs;
+  vim_bytes += size;
+  return (char_u *)malloc(size == 0 ? 1 : size);
+}
+
+char_u *
+alloc_clear(unsigned size)
+{
+  ++vim_allocs;
+  vim_bytes += size;
+  return (char_u *)calloc(1, size == 0 ? 1 : size);
+}
+
+void
+vim_free(void *x)
+{
+  free(x);
+}
+
+void
+vim_strncpy(char_u *to, char_u *from, size_t len)
+{
+  strncpy((char *)to, (char *)from, len);
+  to[len] = '\0';
+}
+
+char_u *
+vim_strsave(char_u *string)
+{
+  unsigned len = (unsigned)STRLEN(string) + 1;
+  char_u *p = alloc(len);
+  if (p != NULL)
+    memcpy(p, string, len);
+  return p;
+}
+
+char_u *
+vim_strnsave(char_u *string, int len)
+{
+  char_u *p = alloc((unsigned)len + 1);
+  if (p != NULL)
+    vim_strncpy(p, string, len);
+  return p;
+}
+
+int
+vim_snprintf(char *str, size_t str_m, char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(str, str_m, fmt, ap);
+  va_end(ap);
+  return n;
+}
+
+/* messages {{{1 */
+
+// Inside :try (VimTryStart()) the message is queued as Vim does.
+int
+emsg(char_u *s)
+{
+  did_emsg = TRUE;
+  if (trylevel > 0) {
+    struct msglist *elem = (struct msglist *)alloc_clear(sizeof(struct msglist));
+    elem->msg = vim_strsave(s);
+    elem->throw_msg = elem->msg;
+    struct msglist **plist = msg_list;
+    while (*plist != NULL)
+      plist = &(*plist)->next;
+    *plist = elem;
+  } else {
+    fprintf(stderr, "%s\n", (char *)s);
+  }
+  return TRUE;
+}
+
+void
+free_global_msglist()
+{
+  while (*msg_list != NULL) {
+    struct msglist *next = (*msg_list)->next;
+    vim_free((*msg_list)->msg);
+    vim_free(*msg_list);
+    *msg_list = next;
+  }
+}
+
+void
+discard_current_exception()
+{
+  current_exception = NULL;
+  did_throw = FALSE;
+}
+
+void
+ui_breakcheck()
+{
+}
+
+/* hashtab (same algorithm as Vim's hashtab.c) {{{1 */
+
+#define PERTURB_SHIFT 5
+
+hash_T
+hash_hash(char_u *key)
+{
+  hash_T hash = *key;
+  if (hash == 0)
+    return 0;
+  for (char_u *p = key + 1; *p != '\0'; ++p)
+    hash = hash * 101 + *p;
+  return hash;
+}
+
+static void
+hash_init(hashtab_T *ht)
+{
+  memset(ht, 0, sizeof(hashtab_T));
+  ht->ht_array = ht->ht_smallarray;
+  ht->ht_mask = HT_INIT_SIZE - 1;
+}
+
+hashitem_T *
+hash_lookup(hashtab_T *ht, char_u *key, hash_T hash)
+{
+  hashitem_T *freeitem;
+  hash_T idx = hash & ht->ht_mask;
+  hashitem_T *hi = &ht->ht_array[idx];
+
+  if (hi->hi_key == NULL)
+    return hi;
+  if (hi->hi_key == HI_KEY_REMOVED)
+    freeitem = hi;
+  else if (hi->hi_hash == hash && strcmp((char *)hi->hi_key, (char *)key) == 0)
+    return hi;
+  else
+    freeitem = NULL;
+
+  for (hash_T perturb = hash; ; perturb >>= PERTURB_SHIFT) {
+    idx = (idx << 2U) + idx + perturb + 1U;
+    hi = &ht->ht_array[idx & ht->ht_mask];
+    if (hi->hi_key == NULL)
+      return freeitem == NULL ? hi : freeitem;
+    if (hi->hi_hash == hash && hi->hi_key != HI_KEY_REMOVED
+        && strcmp((char *)hi->hi_key, (char *)key) == 0)
+      return hi;
+    if (hi->hi_key == HI_KEY_REMOVED && freeitem == NULL)
+      freeitem = hi;
+  }
+}
+
+static int
+hash_may_resize(hashtab_T *ht)
+{
+  if (ht->ht_locked > 0)
+    return OK;
+
+  long_u oldsize = ht->ht_mask + 1;
+  if (ht->ht_filled < HT_INIT_SIZE - 1 && ht->ht_array == ht->ht_smallarray)
+    return OK;
+  if (ht->ht_filled * 3 < oldsize * 2 && ht->ht_used > oldsize / 5)
+    return OK;
+
+  long_u minsize = ht->ht_used > 1000 ? ht->ht_used * 2 : ht->ht_used * 4;
+  long_u newsize = HT_INIT_SIZE;
+  while (newsize < minsize)
+    newsize <<= 1;
+
+  hashitem_T temparray[HT_INIT_SIZE];
+  hashitem_T *oldarray = ht->ht_array;
+  hashitem_T *newarray;
+  bool newarray_is_small = (newsize == HT_INIT_SIZE);
+  if (newarray_is_small) {
+    newarray = ht->ht_smallarray;
+    if (oldarray == ht->ht_smallarray) {
+      memcpy(temparray, oldarray, sizeof(temparray));
+      oldarray = temparray;
+    }
+  } else {
+    newarray = (hashitem_T *)alloc((unsigned)(sizeof(hashitem_T) * newsize));
+    if (newarray == NULL) {
+      ht->ht_error = TRUE;
+      return FAIL;
+    }
+  }
+  memset(newarray, 0, sizeof(hashitem_T) * newsize);
+
+  long_u newmask = newsize - 1;
+  long_u todo = ht->ht_used;
+  for (hashitem_T *olditem = oldarray; todo > 0; ++olditem) {
+    if (!HASHITEM_EMPTY(olditem)) {
+      hash_T newi = olditem->hi_hash & newmask;
+      hashitem_T *newitem = &newarray[newi];
+      if (newitem->hi_key != NULL) {
+        for (hash_T perturb = olditem->hi_hash; ; perturb >>= PERTURB_SHIFT) {
+          newi = (newi << 2U) + newi + perturb + 1U;
+          newitem = &newarray[newi & newmask];
+          if (newitem->hi_key == NULL)
+            break;
+        }
+      }
+      *newitem = *olditem;
+      --todo;
+    }
+  }
+
+  if (ht->ht_array != ht->ht_smallarray)
+    vim_free(ht->ht_array);
+  ht->ht_array = newarray;
+  ht->ht_mask = newmask;
+  ht->ht_filled = ht->ht_used;
+  ht->ht_error = FALSE;
+  return OK;
+}
+
+hashitem_T *
+hash_find(hashtab_T *ht, char_u *key)
+{
+  return hash_lookup(ht, key, hash_hash(key));
+}
+
+int
+hash_add_item(hashtab_T *ht, hashitem_T *hi, char_u *key, hash_T hash)
+{
+  ++ht->ht_used;
+  if (hi->hi_key == NULL)
+    ++ht->ht_filled;
+  hi->hi_key = key;
+  hi->hi_hash = hash;
+  return hash_may_resize(ht);
+}
+
+int
+hash_add(hashtab_T *ht, char_u *key)
+{
+  hash_T hash = hash_hash(key);
+  hashitem_T *hi = hash_lookup(ht, key, hash);
+  if (!HASHITEM_EMPTY(hi)) {
+    emsg((char_u *)"E685: Internal error: hash_add()");
+    return FAIL;
+  }
+  return hash_add_item(ht, hi, key, hash);
+}
+
+void
+hash_remove(hashtab_T *ht, hashitem_T *hi)
+{
+  --ht->ht_used;
+  hi->hi_key = HI_KEY_REMOVED;
+  hash_may_resize(ht);
+}
+
+/* List and Dictionary {{{1 */
+
+list_T *
+list_alloc()
+{
+  return (list_T *)alloc_clear(sizeof(list_T));
+}
+
+void
+list_free(list_T *l, int recurse)
+{
+  listitem_T *item;
+  for (item = l->lv_first; item != NULL; item = l->lv_first) {
+    l->lv_first = item->li_next;
+    if (recurse || (item->li_tv.v_type != VAR_LIST && item->li_tv.v_type != VAR_DICT))
+      clear_tv(&item->li_tv);
+    vim_free(item);
+  }
+  vim_free(l);
+}
+
+void
+list_unref(list_T *l)
+{
+  if (l != NULL && --l->lv_refcount <= 0)
+    list_free(l, TRUE);
+}
+
+dict_T *
+dict_alloc()
+{
+  dict_T *d = (dict_T *)alloc_clear(sizeof(dict_T));
+  if (d != NULL)
+    hash_init(&d->dv_hashtab);
+  return d;
+}
+
+static void
+fake_dict_free(dict_T *d)
+{
+  hashtab_T *ht = &d->dv_hashtab;
+  long_u todo = ht->ht_used;
+  ++ht->ht_locked;
+  for (hashitem_T *hi = ht->ht_array; todo > 0; ++hi) {
+    if (!HASHITEM_EMPTY(hi)) {
+      dictitem_T *di = HI2DI(hi);
+      clear_tv(&di->di_tv);
+      vim_free(di);
+      --todo;
+    }
+  }
+  if (ht->ht_array != ht->ht_smallarray)
+    vim_free(ht->ht_array);
+  vim_free(d);
+}
+
+void
+clear_tv(typval_T *varp)
+{
+  if (varp == NULL)
+    return;
+  switch (varp->v_type) {
+  case VAR_FUNC:
+  case VAR_STRING:
+    vim_free(varp->vval.v_string);
+    varp->vval.v_string = NULL;
+    break;
+  case VAR_LIST:
+    if (varp->vval.v_list != NULL && --varp->vval.v_list->lv_refcount <= 0)
+      list_free(varp->vval.v_list, TRUE);
+    varp->vval.v_list = NULL;
+    break;
+  case VAR_DICT:
+    if (varp->vval.v_dict != NULL && --varp->vval.v_dict->dv_refcount <= 0)
+      fake_dict_free(varp->vval.v_dict);
+    varp->vval.v_dict = NULL;
+    break;
+  default:
+    break;
+  }
+  varp->v_lock = 0;
+}
+
+void
+free_tv(typval_T *varp)
+{
+  clear_tv(varp);
+  vim_free(varp);
+}
+
+}
+
+static void
+copy_tv(typval_T *from, typval_T *to)
+{
+  *to = *from;
+  to->v_lock = 0;
+  switch (from->v_type) {
+  case VAR_FUNC:
+  case VAR_STRING:
+    to->vval.v_string = from->vval.v_string == NULL ? NULL : vim_strsave(from->vval.v_string);
+    break;
+  case VAR_LIST:
+    ++to->vval.v_list->lv_refcount;
+    break;
+  case VAR_DICT:
+    ++to->vval.v_dict->dv_refcount;
+    break;
+  }
+}
+
+/* eval and function {{{1 */
+
+extern "C" {
+
+// Only "g:", "v:", "g:name", "v:name" and a number are supported.
+typval_T *
+eval_expr(char_u *arg, char_u **nextcmd)
+{
+  typval_T *tv = alloc_tv();
+  char *s = (char *)arg;
+  dict_T *scope = NULL;
+  if (strncmp(s, "g:", 2) == 0)
+    scope = fake_globvardict;
+  else if (strncmp(s, "v:", 2) == 0)
+    scope = fake_vimvardict;
+
+  if (scope != NULL && s[2] == '\0') {
+    tv_set_dict(tv, scope);
+    return tv;
+  } else if (scope != NULL) {
+    dictitem_T *di = dict_find(scope, (char_u *)s + 2, -1);
+    if (di != NULL) {
+      copy_tv(&di->di_tv, tv);
+      return tv;
+    }
+  } else if (*s != '\0') {
+    char *end;
+    long n = strtol(s, &end, 10);
+    if (*end == '\0') {
+      tv_set_number(tv, n);
+      return tv;
+    }
+  }
+  vim_free(tv);
+  std::string msg = std::string("E121: Undefined variable: ") + s;
+  emsg((char_u *)msg.c_str());
+  return NULL;
+}
+
+int
+do_cmdline_cmd(char_u *cmd)
+{
+  emsg((char_u *)"fakevim: Ex commands are not supported");
+  return FAIL;
+}
+
+// Only function(), len(), add() and get() are supported.
+int
+func_call(char_u *name, typval_T *args, dict_T *selfdict, typval_T *rettv)
+{
+  list_T *l = args->vval.v_list;
+  typval_T *a0 = l->lv_first == NULL ? NULL : &l->lv_first->li_tv;
+  typval_T *a1 = (a0 == NULL || l->lv_first->li_next == NULL) ? NULL : &l->lv_first->li_next->li_tv;
+  const char *f = (const char *)name;
+
+  if (strcmp(f, "function") == 0 && a0 != NULL && a0->v_type == VAR_STRING) {
+    tv_set_func(rettv, a0->vval.v_string);
+  } else if (strcmp(f, "len") == 0 && a0 != NULL) {
+    if (a0->v_type == VAR_LIST)
+      tv_set_number(rettv, list_len(a0->vval.v_list));
+    else if (a0->v_type == VAR_DICT)
+      tv_set_number(rettv, (varnumber_T)a0->vval.v_dict->dv_hashtab.ht_used);
+    else if (a0->v_type == VAR_STRING)
+      tv_set_number(rettv, a0->vval.v_string == NULL ? 0 : (varnumber_T)STRLEN(a0->vval.v_string));
+    else
+      tv_set_number(rettv, 0);
+  } else if (strcmp(f, "add") == 0 && a0 != NULL && a1 != NULL && a0->v_type == VAR_LIST) {
+    typval_T tv;
+    copy_tv(a1, &tv);
+    list_append_tv_nocopy(a0->vval.v_list, &tv);
+    copy_tv(a0, rettv);
+  } else if (strcmp(f, "get") == 0 && a0 != NULL && a1 != NULL && a0->v_type == VAR_LIST && a1->v_type == VAR_NUMBER) {
+    listitem_T *li = list_find(a0->vval.v_list, a1->vval.v_number);
+    if (li == NULL)
+      tv_set_number(rettv, 0);
+    else
+      copy_tv(&li->li_tv, rettv);
+  } else {
+    std::string msg = std::string("E117: Unknown function: ") + f;
+    emsg((char_u *)msg.c_str());
+    return FAIL;
+  }
+  return OK;
+}
+
+// Only g: variables.  No type or lock checks.
+void
+set_var(char_u *name, typval_T *tv, int copy)
+{
+  const char *s = (const char *)name;
+  if (strncmp(s, "g:", 2) == 0)
+    s += 2;
+  else if (strchr(s, ':') != NULL) {
+    std::string msg = std::string("E461: Illegal variable name: ") + (char *)name;
+    emsg((char_u *)msg.c_str());
+    return;
+  }
+  typval_T v;
+  if (copy || tv->v_type == VAR_NUMBER || tv->v_type == VAR_FLOAT)
+    copy_tv(tv, &v);
+  else {
+    v = *tv;
+    tv->v_type = VAR_UNKNOWN;
+  }
+  dict_set_tv_nocopy(fake_globvardict, (char_u *)s, &v);
+}
+
+/* buffer (one buffer, number 1) {{{1 */
+
+buf_T *
+buflist_findnr(int nr)
+{
+  return nr == 1 ? &fake_buf : NULL;
+}
+
+char_u *
+ml_get_buf(buf_T *buf, linenr_T lnum, int will_change)
+{
+  static char_u empty[1];
+  if (lnum < 1 || lnum > (linenr_T)fake_lines.size())
+    return empty;
+  return fake_lines[lnum - 1];
+}
+
+int
+ml_append(linenr_T lnum, char_u *line, colnr_T len, int newfile)
+{
+  if (lnum < 0 || lnum > (linenr_T)fake_lines.size())
+    return FAIL;
+  fake_lines.insert(fake_lines.begin() + lnum, vim_strsave(line));
+  fake_buf.b_ml.ml_line_count = (linenr_T)fake_lines.size();
+  return OK;
+}
+
+int
+ml_replace(linenr_T lnum, char_u *line, int copy)
+{
+  if (lnum < 1 || lnum > (linenr_T)fake_lines.size())
+    return FAIL;
+  vim_free(fake_lines[lnum - 1]);
+  fake_lines[lnum - 1] = copy ? vim_strsave(line) : line;
+  return OK;
+}
+
+int
+ml_delete(linenr_T lnum, int message)
+{
+  if (lnum < 1 || lnum > (linenr_T)fake_lines.size())
+    return FAIL;
+  vim_free(fake_lines[lnum - 1]);
+  fake_lines.erase(fake_lines.begin() + lnum - 1);
+  if (fake_lines.empty())
+    fake_lines.push_back(vim_strsave((char_u *)""));
+  fake_buf.b_ml.ml_line_count = (linenr_T)fake_lines.size();
+  return OK;
+}
+
+int
+u_save(linenr_T top, linenr_T bot)
+{
+  return OK;
+}
+
+void
+mark_adjust(linenr_T line1, linenr_T line2, long amount, long amount_after)
+{
+}
+
+void
+changed_lines(linenr_T lnum, colnr_T col, linenr_T lnume, long xtra)
+{
+}
+
+void
+switch_buffer(buf_T **save_curbuf, buf_T *buf)
+{
+  *save_curbuf = curbuf;
+  curbuf = buf;
+}
+
+void
+restore_buffer(buf_T *save_curbuf)
+{
+  curbuf = save_curbuf;
+}
+
+void
+check_cursor()
+{
+}
+
+int
+get_option_value(char_u *name, long *numval, char_u **stringval, int opt_flags)
+{
+  if (strcmp((char *)name, "modifiable") != 0)
+    return -3;
+  *numval = 1;
+  return 0;
+}
+
+}
+
+/* benchmark {{{1 */
+
+static void
+set_global(const char *name, typval_T *tv)
+{
+  dict_set_tv_nocopy(fake_globvardict, (char_u *)name, tv);
+}
+
+// Dictionary of "depth" levels with "width" keys each.
+static dict_T *
+make_deep_dict(int depth, int width)
+{
+  dict_T *d = dict_alloc();
+  for (int i = 0; i < width; ++i) {
+    char key[32];
+    typval_T tv;
+    snprintf(key, sizeof(key), "key%d", i);
+    if (depth > 1)
+      tv_set_dict(&tv, make_deep_dict(depth - 1, width));
+    else
+      tv_set_number(&tv, i);
+    dict_set_tv_nocopy(d, (char_u *)key, &tv);
+  }
+  return d;
+}
+
+static void
+make_fixtures()
+{
+  typval_T tv;
+  list_T *l;
+
+  // 10000 numbers
+  l = list_alloc();
+  for (int i = 0; i < 10000; ++i) {
+    tv_set_number(&tv, i);
+    list_append_tv_nocopy(l, &tv);
+  }
+  tv_set_list(&tv, l);
+  set_global("bench_long", &tv);
+
+  // 4^6 leaves
+  tv_set_dict(&tv, make_deep_dict(6, 4));
+  set_global("bench_deep", &tv);
+
+  // 1000 funcrefs
+  l = list_alloc();
+  for (int i = 0; i < 1000; ++i) {
+    tv_set_func(&tv, (char_u *)"len");
+    list_append_tv_nocopy(l, &tv);
+  }
+  tv_set_list(&tv, l);
+  set_global("bench_funcs", &tv);
+
+  // 16 strings of 64KB and 1000 short strings
+  std::string big(65536, 'x');
+  l = list_alloc();
+  for (int i = 0; i < 16; ++i) {
+    tv_set_string(&tv, (char_u *)big.c_str());
+    list_append_tv_nocopy(l, &tv);
+  }
+  tv_set_list(&tv, l);
+  set_global("bench_bigstrings", &tv);
+  l = list_alloc();
+  for (int i = 0; i < 1000; ++i) {
+    char s[32];
+    snprintf(s, sizeof(s), "string %d", i);
+    tv_set_string(&tv, (char_u *)s);
+    list_append_tv_nocopy(l, &tv);
+  }
+  tv_set_list(&tv, l);
+  set_global("bench_strings", &tv);
+
+  // buffer of 10000 lines
+  fake_lines.clear();
+  for (int i = 0; i < 10000; ++i) {
+    char s[64];
+    snprintf(s, sizeof(s), "line %d: the quick brown fox jumps over the lazy dog", i + 1);
+    fake_lines.push_back(vim_strsave((char_u *)s));
+  }
+  fake_buf.b_ml.ml_line_count = (linenr_T)fake_lines.size();
+}
+
+static double
+now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+typedef const char *(*libfunc_T)(const char *);
+
+// JavaScript string literal of s.
+static std::string
+js_quote(const std::string& s)
+{
+  std::string r = "\"";
+  for (size_t i = 0; i < s.size(); ++i) {
+    if (s[i] == '"' || s[i] == '\\')
+      r += '\\';
+    r += s[i];
+  }
+  return r + "\"";
+}
+
+int
+main(int argc, char **argv)
+{
+  long count = 1000;
+  int argi = 1;
+  if (argi + 1 < argc && strcmp(argv[argi], "-n") == 0) {
+    count = atol(argv[argi + 1]);
+    argi += 2;
+  }
+  if (argc - argi != 3 || count <= 0) {
+    fprintf(stderr, "usage: %s [-n count] path/to/if_v8.so runtime.js bench_convert.js\n", argv[0]);
+    return 2;
+  }
+  const char *dll = argv[argi];
+  const char *runtime = argv[argi + 1];
+  const char *script = argv[argi + 2];
+
+  typval_T tv;
+  fake_globvardict = dict_alloc();
+  fake_vimvardict = dict_alloc();
+  ++fake_globvardict->dv_refcount;
+  ++fake_vimvardict->dv_refcount;
+  dict_T *reg = dict_alloc();
+  tv_set_string(&tv, (char_u *)"");
+  dict_set_tv_nocopy(reg, (char_u *)"%v8_cachedir%", &tv);
+  tv_set_dict(&tv, reg);
+  set_global("__if_v8", &tv);
+  fake_lines.push_back(vim_strsave((char_u *)""));
+  fake_buf.b_ml.ml_line_count = 1;
+
+  void *handle = dlopen(dll, RTLD_NOW);
+  if (handle == NULL) {
+    fprintf(stderr, "%s\n", dlerror());
+    return 1;
+  }
+  libfunc_T init = (libfunc_T)dlsym(handle, "init");
+  libfunc_T execute = (libfunc_T)dlsym(handle, "execute");
+  libfunc_T idle = (libfunc_T)dlsym(handle, "idle");
+  if (init == NULL || execute == NULL || idle == NULL) {
+    fprintf(stderr, "%s: not an if_v8 library\n", dll);
+    return 1;
+  }
+
+  const char *err = init((std::string(dll) + ",--expose-gc").c_str());
+  if (err != NULL) {
+    fprintf(stderr, "%s\n", err);
+    return 1;
+  }
+  make_fixtures();
+  execute(("load(" + js_quote(runtime) + ", " + js_quote(script) + ")").c_str());
+  if (did_emsg)
+    return 1;
+
+  // The script sets g:bench_names = Object.keys(benchmarks).
+  dictitem_T *di = dict_find(fake_globvardict, (char_u *)"bench_names", -1);
+  if (di == NULL || di->di_tv.v_type != VAR_LIST) {
+    fprintf(stderr, "%s: g:bench_names is not set\n", script);
+    return 1;
+  }
+
+  printf("%-28s %12s %12s %12s %12s\n", "benchmark", "ns/op", "allocs/op", "bytes/op", "new/op");
+  for (listitem_T *li = di->di_tv.vval.v_list->lv_first; li != NULL; li = li->li_next) {
+    std::string name = (char *)li->li_tv.vval.v_string;
+    std::string warmup = "__bench_run(" + js_quote(name) + ", 10)";
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%ld", count);
+    std::string run = "__bench_run(" + js_quote(name) + ", " + buf + ")";
+
+    execute(warmup.c_str());
+    idle("4000");
+    did_emsg = FALSE;
+
+    unsigned long a0 = vim_allocs, b0 = vim_bytes, n0 = cxx_allocs;
+    double t0 = now_ns();
+    execute(run.c_str());
+    double t1 = now_ns();
+    if (did_emsg) {
+      printf("%-28s failed\n", name.c_str());
+      continue;
+    }
+    printf("%-28s %12.1f %12.2f %12.1f %12.2f\n", name.c_str(),
+        (t1 - t0) / count,
+        (double)(vim_allocs - a0) / count,
+        (double)(vim_bytes - b0) / count,
+        (double)(cxx_allocs - n0) / count);
+  }
+  return 0;
+}
@@ -5,12 +5,23 @@
  * Last Change: 2014-11-02
  * Maintainer: Yukihiro Nakadaira <yukihiro.nakadaira@gmail.com>
  */
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <ctime>
 #include <sstream>
 #include <string>
+#include <deque>
 #include <vector>
+#ifndef WIN32
+# include <pthread.h>
+# include <unistd.h>
+#endif
 #include <v8.h>
+#include <v8-profiler.h>
 #include <libplatform/libplatform.h>
 
 #include "vimext.h"
@@ -19,57 +30,167 @@
 extern "C" {
 DLLEXPORT const char *init(const char *args);
 DLLEXPORT const char *execute(const char *expr);
+DLLEXPORT const char *idle(const char *ms);
+DLLEXPORT const char *uninit(const char *dummy);
 }
 
 using namespace v8;
 
+// thread primitives for Worker and watchdog
+#ifdef WIN32
+typedef HANDLE thread_T;
+typedef CRITICAL_SECTION mutex_T;
+typedef CONDITION_VARIABLE cond_T;
+# define mutex_init(m)      InitializeCriticalSection(m)
+# define mutex_destroy(m)   DeleteCriticalSection(m)
+# define mutex_lock(m)      EnterCriticalSection(m)
+# define mutex_unlock(m)    LeaveCriticalSection(m)
+# define cond_init(c)       InitializeConditionVariable(c)
+# define cond_destroy(c)
+# define cond_wait(c, m)    SleepConditionVariableCS(c, m, INFINITE)
+# define cond_signal(c)     WakeConditionVariable(c)
+# define cond_timedwait(c, m, msec) SleepConditionVariableCS(c, m, msec)
+#else
+typedef pthread_t thread_T;
+typedef pthread_mutex_t mutex_T;
+typedef pthread_cond_t cond_T;
+# define mutex_init(m)      pthread_mutex_init(m, NULL)
+# define mutex_destroy(m)   pthread_mutex_destroy(m)
+# define mutex_lock(m)      pthread_mutex_lock(m)
+# define mutex_unlock(m)    pthread_mutex_unlock(m)
+# define cond_init(c)       pthread_cond_init(c, NULL)
+# define cond_destroy(c)    pthread_cond_destroy(c)
+# define cond_wait(c, m)    pthread_cond_wait(c, m)
+# define cond_signal(c)     pthread_cond_signal(c)
+
+static void
+cond_timedwait(cond_T *c, mutex_T *m, int msec)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec += msec / 1000;
+  ts.tv_nsec += (msec % 1000) * 1000000L;
+  if (ts.tv_nsec >= 1000000000L) {
+    ts.tv_sec += 1;
+    ts.tv_nsec -= 1000000000L;
+  }
+  pthread_cond_timedwait(c, m, &ts);
+}
+#endif
+
+// Open addressing hash table.
+// T must have hash() and operator==.
 template<typename T, typename U>
-class PairTable {
+class HashTable {
 public:
-  typedef std::vector<std::pair<T, U> > container_type;
-  typedef typename container_type::value_type value_type;
-  typedef typename container_type::iterator iterator;
+  typedef std::pair<T, U> value_type;
+  typedef value_type *iterator;
 
-  PairTable() {}
-  iterator begin() { return _container.begin(); }
-  iterator end() { return _container.end(); }
+  HashTable() : _used(0), _filled(0) {}
+  iterator end() { return NULL; }
+  size_t size() const { return _used; }
 
   iterator get(const T& key) {
-    for (iterator it = _container.begin(); it != _container.end(); ++it) {
-      if (it->first == key)
-        return it;
-    }
-    return end();
+    if (_used == 0)
+      return end();
+    size_t i = find(key);
+    if (_table[i].state != USED)
+      return end();
+    return &_table[i].kv;
   }
 
   void set(const T& key, const U& value) {
-    iterator it = get(key);
-    if (it != end())
-      it->second = value;
-    else
-      _container.push_back(value_type(key, value));
+    // keep load factor under 2/3 (removed entries are counted)
+    if ((_filled + 1) * 3 >= _table.size() * 2)
+      rehash(_used * 3 < 16 ? 16 : _used * 3);
+    size_t i = find(key);
+    if (_table[i].state == USED) {
+      _table[i].kv.second = value;
+      return;
+    }
+    if (_table[i].state == EMPTY)
+      ++_filled;
+    _table[i].state = USED;
+    _table[i].kv = value_type(key, value);
+    ++_used;
   }
 
   void del(const T& key) {
-    iterator it = get(key);
-    if (it != end())
-      _container.erase(it);
+    if (_used == 0)
+      return;
+    size_t i = find(key);
+    if (_table[i].state != USED)
+      return;
+    _table[i].state = REMOVED;
+    _table[i].kv = value_type(key, U());
+    --_used;
   }
 
 private:
-  container_type _container;
+  enum { EMPTY, USED, REMOVED };
+  struct entry {
+    entry() : state(EMPTY), kv(T(), U()) {}
+    int state;
+    value_type kv;
+  };
+
+  // Return the slot of key, or the slot where key should be inserted.
+  size_t find(const T& key) const {
+    size_t mask = _table.size() - 1;
+    size_t i = key.hash() & mask;
+    size_t removed = (size_t)-1;
+    for (size_t perturb = key.hash(); ; perturb >>= 5) {
+      const entry& e = _table[i];
+      if (e.state == EMPTY)
+        return removed != (size_t)-1 ? removed : i;
+      if (e.state == REMOVED) {
+        if (removed == (size_t)-1)
+          removed = i;
+      } else if (e.kv.first == key) {
+        return i;
+      }
+      i = (i * 5 + perturb + 1) & mask;
+    }
+  }
+
+  void rehash(size_t minsize) {
+    size_t newsize = 16;
+    while (newsize < minsize)
+      newsize <<= 1;
+    std::vector<entry> old(newsize);
+    old.swap(_table);
+    _used = 0;
+    _filled = 0;
+    for (size_t i = 0; i < old.size(); ++i) {
+      if (old[i].state != USED)
+        continue;
+      size_t j = find(old[i].kv.first);
+      _table[j].state = USED;
+      _table[j].kv = old[i].kv;
+      ++_used;
+      ++_filled;
+    }
+  }
+
+  std::vector<entry> _table;
+  size_t _used;
+  size_t _filled;   // used + removed
 };
 
+// Key of objcache.  List and Dictionary are identified by pointer.
+// Funcref is identified by name, so the hash of name is computed once.
 struct VimValue {
-  VimValue(char_u *val) { v_type = VAR_FUNC; vval.v_string = val; }
-  VimValue(list_T *val) { v_type = VAR_LIST; vval.v_list = val; }
-  VimValue(dict_T *val) { v_type = VAR_DICT; vval.v_dict = val; }
+  VimValue() { v_type = VAR_UNKNOWN; vval.v_string = NULL; _hash = 0; }
+  VimValue(char_u *val) { v_type = VAR_FUNC; vval.v_string = val; _hash = hash_string(val); }
+  VimValue(list_T *val) { v_type = VAR_LIST; vval.v_list = val; _hash = hash_pointer(val); }
+  VimValue(dict_T *val) { v_type = VAR_DICT; vval.v_dict = val; _hash = hash_pointer(val); }
   bool operator==(const VimValue& other) const {
-    if (v_type != other.v_type)
+    if (v_type != other.v_type || _hash != other._hash)
       return false;
     else if (v_type == VAR_FUNC) {
       if (vval.v_string != NULL && other.vval.v_string != NULL)
-        return strcmp((char*)vval.v_string, (char*)other.vval.v_string) == 0;
+        return vval.v_string == other.vval.v_string
+          || strcmp((char*)vval.v_string, (char*)other.vval.v_string) == 0;
       return vval.v_string == other.vval.v_string;
     } else if (v_type == VAR_LIST)
       return vval.v_list == other.vval.v_list;
@@ -77,18 +198,76 @@ struct VimValue {
       return vval.v_dict == other.vval.v_dict;
     return false;
   }
+  size_t hash() const { return _hash; }
+  static size_t hash_pointer(const void *p) {
+    // drop alignment bits and mix high bits
+    size_t h = (size_t)p >> 3;
+    return h ^ (h >> 16);
+  }
+  static size_t hash_string(const char_u *s) {
+    // FNV-1a
+    size_t h = 2166136261U;
+    if (s != NULL)
+      for (; *s != '\0'; ++s)
+        h = (h ^ *s) * 16777619U;
+    return h;
+  }
   char v_type;
   union {
     char_u *v_string;
     list_T *v_list;
     dict_T *v_dict;
   } vval;
+  size_t _hash;
 };
 
-typedef Persistent<Value, CopyablePersistentTraits<Value> > CopyableValuePersistent;
+// Key of V8ToVimLookup.  Object is identified by identity hash.
+struct V8Object {
+  V8Object() : _hash(0) {}
+  explicit V8Object(Handle<Object> obj) : obj(obj), _hash((size_t)obj->GetIdentityHash()) {}
+  bool operator==(const V8Object& other) const { return obj == other.obj; }
+  size_t hash() const { return _hash; }
+  Handle<Object> obj;
+  size_t _hash;
+};
+
+typedef HashTable<V8Object, VimValue> V8ToVimLookup;
+
+// Native side of a VimList, VimDict or VimFunc object.  Holds a reference
+// to the Vim value while the V8 object is alive.  Lists and Dictionaries
+// are also linked into v_pin (see PinValue()).
+struct VimRef {
+  VimValue key() const {
+    if (tv.v_type == VAR_LIST)
+      return VimValue(tv.vval.v_list);
+    if (tv.v_type == VAR_DICT)
+      return VimValue(tv.vval.v_dict);
+    return VimValue(tv.vval.v_string);
+  }
+  typval_T tv;
+  listitem_T *pin;      // item in v_pin, NULL for Funcref
+  Persistent<Value> self;
+};
+
+typedef HashTable<VimValue, VimRef*> VimToV8Lookup;
+
+// Backing store of an ArrayBuffer made by vim.ListToArray().  V8 gives no
+// pointer to the contents of a buffer it allocated, so the data is
+// allocated here, filled in place and freed when the buffer is collected.
+struct ExternalBuffer {
+  void *data;
+  size_t size;
+  Persistent<ArrayBuffer> self;
+};
 
-typedef PairTable<Handle<Value>, VimValue> V8ToVimLookup;
-typedef PairTable<VimValue, CopyableValuePersistent> VimToV8Lookup;
+// ArrayBuffer needs an allocator set before the isolate is created.
+class ArrayBufferAllocator : public ArrayBuffer::Allocator {
+public:
+  virtual void *Allocate(size_t length) { return calloc(length, 1); }
+  virtual void *AllocateUninitialized(size_t length) { return malloc(length); }
+  virtual void Free(void *data, size_t length) { free(data); }
+};
+static ArrayBufferAllocator array_buffer_allocator;
 
 static void *dll_handle = NULL;
 static Isolate *isolate;
@@ -96,6 +275,9 @@ static Persistent<Context> p_context;
 static Persistent<FunctionTemplate> p_VimList;
 static Persistent<FunctionTemplate> p_VimDict;
 static Persistent<FunctionTemplate> p_VimFunc;
+static Persistent<FunctionTemplate> p_VimListIter;
+static Persistent<FunctionTemplate> p_VimBuffer;
+static Persistent<FunctionTemplate> p_Worker;
 
 // ensure the following condition:
 //   var x = new vim.Dict();
@@ -107,30 +289,123 @@ static VimToV8Lookup objcache;
 // register
 static dict_T *v_reg;
 
-// reg['%v8_weak%']
-// keep reference to avoid garbage collect.
-static dict_T *v_weak;
+// reg['%v8_pin%']
+// Lists and Dictionaries referenced from V8.  Vim's garbage collector
+// frees what is not reachable from a variable even if its refcount is not
+// zero, so they are linked here.  Each owner keeps its list item, so
+// pinning and unpinning are O(1).  Funcref needs only the refcount.
+// The item is locked and the list referenced until uninit().  NULL before
+// init() and after uninit().
+static list_T *v_pin;
+
+// reg['%v8_cachedir%']
+// directory for code cache of load()ed files.  empty to disable.
+static std::string cache_dir;
+
+// Recently executed :V8 snippets, most recently used first.  Only a few
+// entries are kept, so linear search is enough.
+class ScriptCache {
+public:
+  typedef Persistent<UnboundScript, CopyablePersistentTraits<UnboundScript> > UnboundScriptPersistent;
+
+  ScriptCache(size_t capacity) : _capacity(capacity) {}
+
+  // Returns empty handle when not found.
+  Local<UnboundScript> get(const std::string& source) {
+    size_t h = VimValue::hash_string((const char_u *)source.c_str());
+    for (size_t i = 0; i < _entries.size(); ++i) {
+      if (_entries[i].hash == h && _entries[i].source == source) {
+        std::rotate(_entries.begin(), _entries.begin() + i, _entries.begin() + i + 1);
+        return Local<UnboundScript>::New(isolate, _entries[0].script);
+      }
+    }
+    return Local<UnboundScript>();
+  }
+
+  size_t size() const { return _entries.size(); }
+
+  void set(const std::string& source, Handle<UnboundScript> script) {
+    if (_entries.size() >= _capacity)
+      _entries.pop_back();
+    entry e;
+    e.hash = VimValue::hash_string((const char_u *)source.c_str());
+    e.source = source;
+    e.script.Reset(isolate, script);
+    _entries.insert(_entries.begin(), e);
+  }
+
+private:
+  struct entry {
+    size_t hash;
+    std::string source;
+    UnboundScriptPersistent script;
+  };
+
+  size_t _capacity;
+  std::vector<entry> _entries;
+};
+
+static ScriptCache scriptcache(16);
 
 static const char *init_v8(std::string args);
 
 static bool vim_to_v8(typval_T *vimobj, Handle<Value> *v8obj, int depth, VimToV8Lookup *lookup, std::string *err);
 static bool v8_to_vim(Handle<Value> v8obj, typval_T *vimobj, int depth, V8ToVimLookup *lookup, std::string *err);
 
-static void weak_ref(typval_T *tv);
-static void weak_unref(typval_T *tv);
-
-static Handle<String> ReadFile(const char* name);
-static bool ExecuteString(Handle<String> source, Handle<Value> name, bool print_result, bool report_exceptions, std::string& err);
+static Handle<String> MakeV8String(char_u *str);
+static void tv_set_v8string(typval_T *tv, Handle<String> str);
+static dictitem_T *dictitem_alloc_v8(Handle<String> key);
+
+static listitem_T *PinValue(typval_T *tv);
+static void UnpinValue(listitem_T *li);
+static VimRef *VimRefNew(Handle<Object> self, typval_T *tv);
+static void VimRefDestroy(const WeakCallbackData<Value, VimRef>& data);
+static Handle<ArrayBuffer> ExternalBufferNew(size_t size, void **data);
+static void ExternalBufferDestroy(const WeakCallbackData<ArrayBuffer, ExternalBuffer>& data);
+
+static Handle<String> ReadFile(const char* name, const char *prefix = "", const char *suffix = "", std::string *cache_header = NULL);
+static std::string CodeCacheHeader(const char *source, size_t len);
+enum ScriptCacheMode {
+  SCRIPT_CACHE_NONE,
+  SCRIPT_CACHE_MEMORY,  // keep compiled script in scriptcache
+  SCRIPT_CACHE_DISK,    // keep code cache in cache_dir
+  SCRIPT_CACHE_MODULE   // same as SCRIPT_CACHE_DISK, for a module wrapper
+};
+static Local<Script> CompileScript(Handle<String> source, Handle<Value> name, ScriptCacheMode mode, const std::string& cache_header = std::string());
+static bool ExecuteString(Handle<String> source, Handle<Value> name, bool print_result, bool report_exceptions, std::string& err, ScriptCacheMode mode = SCRIPT_CACHE_NONE, const std::string& cache_header = std::string());
 static void ReportException(TryCatch* try_catch);
 
+static void VimTryStart();
+static bool VimTryEnd(std::string *err);
+static bool CallVimFunc(char_u *name, int argc, Handle<Value> *argv, Handle<Value> self, Handle<Value> *result, std::string *err);
+
 // functions
 static void vim_execute(const FunctionCallbackInfo<Value>& args);
+static void vim_call(const FunctionCallbackInfo<Value>& args);
+static void vim_eval(const FunctionCallbackInfo<Value>& args);
+static void vim_let(const FunctionCallbackInfo<Value>& args);
+static void vim_ListToArray(const FunctionCallbackInfo<Value>& args);
+static void vim_ArrayToList(const FunctionCallbackInfo<Value>& args);
+static void vim_DictToObject(const FunctionCallbackInfo<Value>& args);
+static void vim_ObjectToDict(const FunctionCallbackInfo<Value>& args);
+static void vim_heapStats(const FunctionCallbackInfo<Value>& args);
+static void vim_jsonEncode(const FunctionCallbackInfo<Value>& args);
+static void vim_jsonDecode(const FunctionCallbackInfo<Value>& args);
+
+// vim.profiler
+static void ProfilerStart(const FunctionCallbackInfo<Value>& args);
+static void ProfilerStop(const FunctionCallbackInfo<Value>& args);
+static void ProfilerHeapSnapshot(const FunctionCallbackInfo<Value>& args);
+static void ProfilerStartHeapTracking(const FunctionCallbackInfo<Value>& args);
+static void ProfilerStopHeapTracking(const FunctionCallbackInfo<Value>& args);
+static void ProfilerCallbackStats(const FunctionCallbackInfo<Value>& args);
+static void ProfilerResetCallbackStats(const FunctionCallbackInfo<Value>& args);
 static void Load(const FunctionCallbackInfo<Value>& args);
+static void vim_compileModule(const FunctionCallbackInfo<Value>& args);
 
 // VimList
 static Handle<Value> MakeVimList(list_T *list);
 static void VimListCreate(const FunctionCallbackInfo<Value>& args);
-static void VimListDestroy(const WeakCallbackData<Value, typval_T>& data);
 static void VimListGet(uint32_t index, const PropertyCallbackInfo<Value>& info);
 static void VimListSet(uint32_t index, Local<Value> value, const PropertyCallbackInfo<Value>& info);
 static void VimListQuery(uint32_t index, const PropertyCallbackInfo<Integer>& info);
@@ -138,9 +413,14 @@ static void VimListDelete(uint32_t index, const PropertyCallbackInfo<Boolean>& i
 static void VimListEnumerate(const PropertyCallbackInfo<Array>& info);
 static void VimListLength(Local<String> property, const PropertyCallbackInfo<Value>& info);
 
+// VimListIter
+struct ListIterator;
+static void VimListIterator(const FunctionCallbackInfo<Value>& args);
+static void VimListIterNext(const FunctionCallbackInfo<Value>& args);
+static void VimListIterDestroy(const WeakCallbackData<Value, ListIterator>& data);
+
 // VimDict
 static Handle<Value> MakeVimDict(dict_T *dict);
-static void VimDictDestroy(const WeakCallbackData<Value, typval_T>& data);
 static void VimDictCreate(const FunctionCallbackInfo<Value>& args);
 static void VimDictIdxGet(uint32_t index, const PropertyCallbackInfo<Value>& info);
 static void VimDictIdxSet(uint32_t index, Local<Value> value, const PropertyCallbackInfo<Value>& info);
@@ -154,9 +434,25 @@ static void VimDictEnumerate(const PropertyCallbackInfo<Array>& info);
 
 // VimFunc
 static Handle<Value> MakeVimFunc(const char *name);
-static void VimFuncDestroy(const WeakCallbackData<Value, typval_T>& data);
 static void VimFuncCall(const FunctionCallbackInfo<Value>& args);
 
+// VimBuffer
+static void vim_buffer(const FunctionCallbackInfo<Value>& args);
+static void VimBufferLineCount(const FunctionCallbackInfo<Value>& args);
+static void VimBufferGetLines(const FunctionCallbackInfo<Value>& args);
+static void VimBufferSetLines(const FunctionCallbackInfo<Value>& args);
+
+// Worker
+static void WorkerCreate(const FunctionCallbackInfo<Value>& args);
+static void WorkerPostMessage(const FunctionCallbackInfo<Value>& args);
+static void WorkerTerminate(const FunctionCallbackInfo<Value>& args);
+static void DeliverWorkerMessages();
+
+// watchdog
+static void WatchdogStart();
+static bool WatchdogStop(std::string *err);
+static bool WatchdogFired();
+
 struct Trace {
   std::string name_;
   Trace(std::string name) {
@@ -168,9 +464,68 @@ struct Trace {
   }
 };
 
+// Wall time of native callbacks, read by vim.profiler.callbackStats().
+// Each TRACE() site has its own static CallbackStat, so recording does not
+// look up anything.
+struct CallbackStat {
+  enum { NBUCKETS = 24 };   // bucket i: < 2^i usec
+  const char *name;
+  unsigned long count;
+  double total;             // usec
+  unsigned long buckets[NBUCKETS];
+  CallbackStat *next;
+  static CallbackStat *head;
+
+  CallbackStat(const char *n) : name(n), next(head) {
+    reset();
+    head = this;
+  }
+  void reset() {
+    count = 0;
+    total = 0;
+    memset(buckets, 0, sizeof(buckets));
+  }
+  void add(double usec) {
+    int i = 0;
+    while (i < NBUCKETS - 1 && usec >= (double)(1UL << i))
+      ++i;
+    ++count;
+    total += usec;
+    ++buckets[i];
+  }
+};
+
+CallbackStat *CallbackStat::head = NULL;
+
+// monotonic clock in usec
+static double
+MonotonicTime()
+{
+#ifdef WIN32
+  LARGE_INTEGER freq, count;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&count);
+  return (double)count.QuadPart * 1000000.0 / (double)freq.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+#endif
+}
+
+struct CallbackTimer {
+  CallbackStat *stat_;
+  double start_;
+  CallbackTimer(CallbackStat *stat) : stat_(stat), start_(MonotonicTime()) {}
+  ~CallbackTimer() { stat_->add(MonotonicTime() - start_); }
+};
+
 //#define DEBUG
+//#define PROFILE_CALLBACKS
 #if defined(DEBUG)
 # define TRACE(name) Trace trace__(name)
+#elif defined(PROFILE_CALLBACKS)
+# define TRACE(name) static CallbackStat trace_stat__(name); CallbackTimer trace__(&trace_stat__)
 #else
 # define TRACE(name)
 #endif
@@ -200,15 +555,253 @@ const char *
 execute(const char *expr)
 {
   TRACE("execute");
+  if (v_pin == NULL)
+    return "error: if_v8 is not initialized";
+  Isolate::Scope isolate_scope(isolate);
+  HandleScope handle_scope(isolate);
+  Context::Scope context_scope(Local<Context>::New(isolate, p_context));
+  std::string err;
+  // worker handlers are JavaScript too: watch them with the script
+  WatchdogStart();
+  DeliverWorkerMessages();
+  bool ok = !WatchdogFired() && ExecuteString(String::NewFromUtf8(isolate, expr), String::NewFromUtf8(isolate, "(command-line)"), true, true, err, SCRIPT_CACHE_MEMORY);
+  if (WatchdogStop(&err))
+    ok = false;
+  // termination is reported by the outermost execute()
+  if (!ok && !V8::IsExecutionTerminating(isolate))
+    emsg((char_u*)err.c_str());
+  return NULL;
+}
+
+// Resident size of the process in bytes, 0 when unknown.  This is mostly
+// Vim's memory: V8 heap is small compared with buffers and undo.
+static size_t
+ProcessMemory()
+{
+#if defined(__linux__)
+  FILE *file = fopen("/proc/self/statm", "r");
+  if (file == NULL)
+    return 0;
+  unsigned long size, resident;
+  int n = fscanf(file, "%lu %lu", &size, &resident);
+  fclose(file);
+  if (n != 2)
+    return 0;
+  long pagesize = sysconf(_SC_PAGESIZE);
+  if (pagesize <= 0)
+    return 0;
+  return (size_t)resident * (size_t)pagesize;
+#else
+  return 0;
+#endif
+}
+
+// When process memory grew this much since the last check, tell V8 to
+// release memory.  Wrappers pin Vim Lists and Dictionaries until V8
+// collects them.
+#define MEMORY_PRESSURE_STEP (64 * 1024 * 1024)
+static size_t last_process_memory = 0;
+
+/* args = idle time in msec */
+const char *
+idle(const char *ms)
+{
+  TRACE("idle");
+  if (v_pin == NULL)
+    return NULL;
   Isolate::Scope isolate_scope(isolate);
   HandleScope handle_scope(isolate);
   Context::Scope context_scope(Local<Context>::New(isolate, p_context));
+
   std::string err;
-  if (!ExecuteString(String::NewFromUtf8(isolate, expr), String::NewFromUtf8(isolate, "(command-line)"), true, true, err))
+  WatchdogStart();
+  DeliverWorkerMessages();
+  if (WatchdogStop(&err))
     emsg((char_u*)err.c_str());
+
+  size_t mem = ProcessMemory();
+  if (mem > last_process_memory + MEMORY_PRESSURE_STEP) {
+    isolate->LowMemoryNotification();
+    last_process_memory = ProcessMemory();
+    return NULL;
+  }
+  if (mem != 0 && mem < last_process_memory)
+    last_process_memory = mem;
+
+  // Idle time is how long Vim was waiting for a key ('updatetime').  Use a
+  // part of it so that the next key is not delayed, and do the work in
+  // small steps until V8 says there is nothing more to do.
+  int budget = atoi(ms) / 4;
+  if (budget < 10)
+    budget = 10;
+  else if (budget > 100)
+    budget = 100;
+  for (int i = 0; i < 10; ++i)
+    if (isolate->IdleNotification(budget / 10 + 1))
+      break;
+  return NULL;
+}
+
+// Called on VimLeavePre.  V8 does not run weak callbacks at exit, so the
+// pinned values stay referenced by their items; dropping v_pin releases
+// them once.  No JavaScript runs after this.
+const char *
+uninit(const char *dummy)
+{
+  TRACE("uninit");
+  if (v_pin == NULL)
+    return NULL;
+  dictitem_T *di = dict_find(v_reg, (char_u*)"%v8_pin%", -1);
+  if (di != NULL && di->di_tv.v_type == VAR_LIST && di->di_tv.vval.v_list == v_pin)
+    di->di_tv.v_lock = 0;
+  v_pin->lv_lock = 0;
+  list_unref(v_pin);
+  v_pin = NULL;
   return NULL;
 }
 
+// Watchdog
+//
+// One thread watches the outermost execute() and the delivery of worker
+// messages in idle().  It terminates the script when g:if_v8_timeout msec
+// have passed, and requests an interrupt every WATCHDOG_INTERVAL msec so
+// that the main thread can check Ctrl-C (ui_breakcheck() must be called on
+// the main thread).  execute() only takes a lock to arm and disarm it.
+
+#define WATCHDOG_INTERVAL 100
+
+static struct {
+  mutex_T mutex;
+  cond_T cond;
+  bool started;
+  bool running;                 // execute() is running
+  unsigned long generation;     // incremented for each run
+  double deadline;              // MonotonicTime(), 0 for no deadline
+  bool timed_out;
+  bool interrupted;
+} watchdog;
+
+static int execute_depth = 0;
+static unsigned long terminated_count = 0;
+static unsigned long interrupted_count = 0;
+
+// Called on the main thread while JavaScript is running.
+static void
+WatchdogInterrupt(Isolate *is, void *data)
+{
+  ui_breakcheck();
+  if (got_int) {
+    mutex_lock(&watchdog.mutex);
+    watchdog.interrupted = true;
+    mutex_unlock(&watchdog.mutex);
+    is->TerminateExecution();
+  }
+}
+
+#ifdef WIN32
+static DWORD WINAPI
+#else
+static void *
+#endif
+WatchdogMain(void *arg)
+{
+  mutex_lock(&watchdog.mutex);
+  for (;;) {
+    while (!watchdog.running)
+      cond_wait(&watchdog.cond, &watchdog.mutex);
+    unsigned long generation = watchdog.generation;
+    cond_timedwait(&watchdog.cond, &watchdog.mutex, WATCHDOG_INTERVAL);
+    if (!watchdog.running || watchdog.generation != generation)
+      continue;
+    if (watchdog.deadline != 0 && MonotonicTime() >= watchdog.deadline) {
+      watchdog.deadline = 0;
+      watchdog.timed_out = true;
+      isolate->TerminateExecution();
+    } else {
+      isolate->RequestInterrupt(WatchdogInterrupt, NULL);
+    }
+  }
+  return 0;
+}
+
+static void
+WatchdogStart()
+{
+  if (execute_depth++ > 0)
+    return;
+
+  long timeout = 0;
+  dictitem_T *di = dict_find(&globvardict, (char_u*)"if_v8_timeout", -1);
+  if (di != NULL && di->di_tv.v_type == VAR_NUMBER)
+    timeout = di->di_tv.vval.v_number;
+
+  if (!watchdog.started) {
+    mutex_init(&watchdog.mutex);
+    cond_init(&watchdog.cond);
+#ifdef WIN32
+    HANDLE thread = CreateThread(NULL, 0, WatchdogMain, NULL, 0, NULL);
+    if (thread == NULL)
+      return;
+    CloseHandle(thread);
+#else
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, WatchdogMain, NULL) != 0)
+      return;
+    pthread_detach(thread);
+#endif
+    watchdog.started = true;
+  }
+
+  mutex_lock(&watchdog.mutex);
+  watchdog.running = true;
+  ++watchdog.generation;
+  watchdog.deadline = timeout > 0 ? MonotonicTime() + timeout * 1000.0 : 0;
+  watchdog.timed_out = false;
+  watchdog.interrupted = false;
+  cond_signal(&watchdog.cond);
+  mutex_unlock(&watchdog.mutex);
+}
+
+// Returns true when the current run has been timed out or interrupted.
+static bool
+WatchdogFired()
+{
+  if (!watchdog.started)
+    return false;
+  mutex_lock(&watchdog.mutex);
+  bool fired = watchdog.timed_out || watchdog.interrupted;
+  mutex_unlock(&watchdog.mutex);
+  return fired;
+}
+
+// Returns true and sets err when the run was terminated.
+static bool
+WatchdogStop(std::string *err)
+{
+  if (--execute_depth > 0 || !watchdog.started)
+    return false;
+
+  mutex_lock(&watchdog.mutex);
+  watchdog.running = false;
+  bool timed_out = watchdog.timed_out;
+  bool interrupted = watchdog.interrupted;
+  mutex_unlock(&watchdog.mutex);
+  isolate->ClearInterrupt();
+
+  if (!timed_out && !interrupted)
+    return false;
+  isolate->CancelTerminateExecution();
+  if (timed_out) {
+    ++terminated_count;
+    *err = "if_v8: script timed out (g:if_v8_timeout)";
+  } else {
+    ++interrupted_count;
+    got_int = FALSE;
+    *err = "if_v8: Interrupted";
+  }
+  return true;
+}
+
 static const char *
 init_v8(std::string args)
 {
@@ -220,7 +813,9 @@ init_v8(std::string args)
   V8::Initialize();
   V8::SetFlagsFromString(args.c_str(), args.length());
 
+  V8::SetArrayBufferAllocator(&array_buffer_allocator);
   isolate = Isolate::New();
+  last_process_memory = ProcessMemory();
 
   Isolate::Scope isolate_scope(isolate);
   HandleScope handle_scope(isolate);
@@ -233,12 +828,23 @@ init_v8(std::string args)
   v_reg = ptv->vval.v_dict;
   free_tv(ptv);
 
-  v_weak = dict_alloc();
-  if (v_weak == NULL)
-    return "init_v8(): error dict_alloc()";
+  dictitem_T *di = dict_find(v_reg, (char_u*)"%v8_cachedir%", -1);
+  if (di != NULL && di->di_tv.v_type == VAR_STRING && di->di_tv.vval.v_string != NULL)
+    cache_dir = (char *)di->di_tv.vval.v_string;
+
+  v_pin = list_alloc();
+  if (v_pin == NULL)
+    return "init_v8(): error list_alloc()";
   typval_T tv;
-  tv_set_dict(&tv, v_weak);
-  dict_set_tv_nocopy(v_reg, (char_u*)"%v8_weak%", &tv);
+  tv_set_list(&tv, v_pin);
+  dict_set_tv_nocopy(v_reg, (char_u*)"%v8_pin%", &tv);
+  // The item makes the list reachable for Vim's garbage collector.  A
+  // script can still remove it, so keep a reference of our own and lock
+  // the item (as :lockvar 1 does) until uninit().
+  ++v_pin->lv_refcount;
+  di = dict_find(v_reg, (char_u*)"%v8_pin%", -1);
+  di->di_tv.v_lock = VAR_FIXED;
+  v_pin->lv_lock = VAR_FIXED;
 
   p_VimList.Reset(isolate, FunctionTemplate::New(isolate, VimListCreate));
   Local<FunctionTemplate> VimList = Local<FunctionTemplate>::New(isolate, p_VimList);
@@ -248,6 +854,15 @@ init_v8(std::string args)
   VimListTemplate->SetIndexedPropertyHandler(VimListGet, VimListSet, VimListQuery, VimListDelete, VimListEnumerate);
   VimListTemplate->SetAccessor(String::NewFromUtf8(isolate, "length"), VimListLength, NULL, Handle<Value>(), DEFAULT, (PropertyAttribute)(DontEnum|DontDelete));
 
+  VimList->Set(String::NewFromUtf8(isolate, "iterator"), FunctionTemplate::New(isolate, VimListIterator));
+
+  p_VimListIter.Reset(isolate, FunctionTemplate::New(isolate));
+  Local<FunctionTemplate> VimListIter = Local<FunctionTemplate>::New(isolate, p_VimListIter);
+  VimListIter->SetClassName(String::NewFromUtf8(isolate, "VimListIterator"));
+  VimListIter->InstanceTemplate()->SetInternalFieldCount(1);
+  VimListIter->PrototypeTemplate()->Set(String::NewFromUtf8(isolate, "next"),
+      FunctionTemplate::New(isolate, VimListIterNext, Handle<Value>(), Signature::New(isolate, VimListIter)));
+
   p_VimDict.Reset(isolate, FunctionTemplate::New(isolate, VimDictCreate));
   Local<FunctionTemplate> VimDict = Local<FunctionTemplate>::New(isolate, p_VimDict);
   VimDict->SetClassName(String::NewFromUtf8(isolate, "VimDict"));
@@ -264,11 +879,61 @@ init_v8(std::string args)
   VimFuncTemplate->SetInternalFieldCount(2);
   VimFuncTemplate->SetCallAsFunctionHandler(VimFuncCall);
 
+  p_VimBuffer.Reset(isolate, FunctionTemplate::New(isolate));
+  Local<FunctionTemplate> VimBuffer = Local<FunctionTemplate>::New(isolate, p_VimBuffer);
+  VimBuffer->SetClassName(String::NewFromUtf8(isolate, "VimBuffer"));
+  // [0]=buffer number
+  VimBuffer->InstanceTemplate()->SetInternalFieldCount(1);
+  Handle<ObjectTemplate> VimBufferProto = VimBuffer->PrototypeTemplate();
+  VimBufferProto->Set(String::NewFromUtf8(isolate, "lineCount"),
+      FunctionTemplate::New(isolate, VimBufferLineCount, Handle<Value>(), Signature::New(isolate, VimBuffer)));
+  VimBufferProto->Set(String::NewFromUtf8(isolate, "getLines"),
+      FunctionTemplate::New(isolate, VimBufferGetLines, Handle<Value>(), Signature::New(isolate, VimBuffer)));
+  VimBufferProto->Set(String::NewFromUtf8(isolate, "setLines"),
+      FunctionTemplate::New(isolate, VimBufferSetLines, Handle<Value>(), Signature::New(isolate, VimBuffer)));
+
+  p_Worker.Reset(isolate, FunctionTemplate::New(isolate, WorkerCreate));
+  Local<FunctionTemplate> Worker = Local<FunctionTemplate>::New(isolate, p_Worker);
+  Worker->SetClassName(String::NewFromUtf8(isolate, "Worker"));
+  // [0]=Worker*
+  Worker->InstanceTemplate()->SetInternalFieldCount(1);
+  Worker->PrototypeTemplate()->Set(String::NewFromUtf8(isolate, "postMessage"),
+      FunctionTemplate::New(isolate, WorkerPostMessage, Handle<Value>(), Signature::New(isolate, Worker)));
+  Worker->PrototypeTemplate()->Set(String::NewFromUtf8(isolate, "terminate"),
+      FunctionTemplate::New(isolate, WorkerTerminate, Handle<Value>(), Signature::New(isolate, Worker)));
+
   Handle<ObjectTemplate> vim = ObjectTemplate::New();
   vim->Set(String::NewFromUtf8(isolate, "execute"), FunctionTemplate::New(isolate, vim_execute));
+  vim->Set(String::NewFromUtf8(isolate, "call"), FunctionTemplate::New(isolate, vim_call));
+  vim->Set(String::NewFromUtf8(isolate, "eval"), FunctionTemplate::New(isolate, vim_eval));
+  vim->Set(String::NewFromUtf8(isolate, "let"), FunctionTemplate::New(isolate, vim_let));
+  vim->Set(String::NewFromUtf8(isolate, "ListToArray"), FunctionTemplate::New(isolate, vim_ListToArray));
+  vim->Set(String::NewFromUtf8(isolate, "ArrayToList"), FunctionTemplate::New(isolate, vim_ArrayToList));
+  vim->Set(String::NewFromUtf8(isolate, "DictToObject"), FunctionTemplate::New(isolate, vim_DictToObject));
+  vim->Set(String::NewFromUtf8(isolate, "ObjectToDict"), FunctionTemplate::New(isolate, vim_ObjectToDict));
+  vim->Set(String::NewFromUtf8(isolate, "heapStats"), FunctionTemplate::New(isolate, vim_heapStats));
+  vim->Set(String::NewFromUtf8(isolate, "_compileModule"), FunctionTemplate::New(isolate, vim_compileModule));
   vim->Set(String::NewFromUtf8(isolate, "List"), VimList);
   vim->Set(String::NewFromUtf8(isolate, "Dict"), VimDict);
   vim->Set(String::NewFromUtf8(isolate, "Func"), VimFunc);
+  vim->Set(String::NewFromUtf8(isolate, "Buffer"), VimBuffer);
+  vim->Set(String::NewFromUtf8(isolate, "Worker"), Worker);
+  vim->Set(String::NewFromUtf8(isolate, "buffer"), FunctionTemplate::New(isolate, vim_buffer));
+
+  Handle<ObjectTemplate> profiler = ObjectTemplate::New();
+  profiler->Set(String::NewFromUtf8(isolate, "start"), FunctionTemplate::New(isolate, ProfilerStart));
+  profiler->Set(String::NewFromUtf8(isolate, "stop"), FunctionTemplate::New(isolate, ProfilerStop));
+  profiler->Set(String::NewFromUtf8(isolate, "heapSnapshot"), FunctionTemplate::New(isolate, ProfilerHeapSnapshot));
+  profiler->Set(String::NewFromUtf8(isolate, "startHeapTracking"), FunctionTemplate::New(isolate, ProfilerStartHeapTracking));
+  profiler->Set(String::NewFromUtf8(isolate, "stopHeapTracking"), FunctionTemplate::New(isolate, ProfilerStopHeapTracking));
+  profiler->Set(String::NewFromUtf8(isolate, "callbackStats"), FunctionTemplate::New(isolate, ProfilerCallbackStats));
+  profiler->Set(String::NewFromUtf8(isolate, "resetCallbackStats"), FunctionTemplate::New(isolate, ProfilerResetCallbackStats));
+  vim->Set(String::NewFromUtf8(isolate, "profiler"), profiler);
+
+  Handle<ObjectTemplate> json = ObjectTemplate::New();
+  json->Set(String::NewFromUtf8(isolate, "encode"), FunctionTemplate::New(isolate, vim_jsonEncode));
+  json->Set(String::NewFromUtf8(isolate, "decode"), FunctionTemplate::New(isolate, vim_jsonDecode));
+  vim->Set(String::NewFromUtf8(isolate, "json"), json);
 
   Handle<ObjectTemplate> global = ObjectTemplate::New();
   global->Set(String::NewFromUtf8(isolate, "load"), FunctionTemplate::New(isolate, Load));
@@ -312,7 +977,7 @@ vim_to_v8(typval_T *vimobj, Handle<Value> *v8obj, int depth, VimToV8Lookup *look
     if (vimobj->vval.v_string == NULL)
       *v8obj = String::NewFromUtf8(isolate, "");
     else
-      *v8obj = String::NewFromUtf8(isolate, (char *)vimobj->vval.v_string);
+      *v8obj = MakeV8String(vimobj->vval.v_string);
     return true;
   }
 
@@ -324,7 +989,7 @@ vim_to_v8(typval_T *vimobj, Handle<Value> *v8obj, int depth, VimToV8Lookup *look
     }
     VimToV8Lookup::iterator it = lookup->get(VimValue(list));
     if (it != lookup->end()) {
-      *v8obj = Local<Value>::New(isolate, it->second);
+      *v8obj = Local<Value>::New(isolate, it->second->self);
       return true;
     }
 #if 1
@@ -354,7 +1019,7 @@ vim_to_v8(typval_T *vimobj, Handle<Value> *v8obj, int depth, VimToV8Lookup *look
     }
     VimToV8Lookup::iterator it = lookup->get(VimValue(dict));
     if (it != lookup->end()) {
-      *v8obj = Local<Value>::New(isolate, it->second);
+      *v8obj = Local<Value>::New(isolate, it->second->self);
       return true;
     }
 #if 1
@@ -386,7 +1051,7 @@ vim_to_v8(typval_T *vimobj, Handle<Value> *v8obj, int depth, VimToV8Lookup *look
   if (vimobj->v_type == VAR_FUNC) {
     VimToV8Lookup::iterator it = lookup->get(VimValue(vimobj->vval.v_string));
     if (it != lookup->end()) {
-      *v8obj = Local<Value>::New(isolate, it->second);
+      *v8obj = Local<Value>::New(isolate, it->second->self);
       return true;
     }
     *v8obj = MakeVimFunc((char *)vimobj->vval.v_string);
@@ -406,28 +1071,21 @@ v8_to_vim(Handle<Value> v8obj, typval_T *vimobj, int depth, V8ToVimLookup *looku
     return false;
   }
 
-  Local<FunctionTemplate> VimList = Local<FunctionTemplate>::New(isolate, p_VimList);
-  Local<FunctionTemplate> VimDict = Local<FunctionTemplate>::New(isolate, p_VimDict);
-  Local<FunctionTemplate> VimFunc = Local<FunctionTemplate>::New(isolate, p_VimFunc);
-
-  if (VimList->HasInstance(v8obj)) {
-    Handle<Object> o = Handle<Object>::Cast(v8obj);
-    Handle<External> external = Handle<External>::Cast(o->GetInternalField(0));
-    tv_set_list(vimobj, static_cast<list_T*>(external->Value()));
+  // Primitives are checked first.  They don't need the templates.
+  if (v8obj->IsInt32()) {
+    tv_set_number(vimobj, v8obj->Int32Value());
     return true;
   }
 
-  if (VimDict->HasInstance(v8obj)) {
-    Handle<Object> o = Handle<Object>::Cast(v8obj);
-    Handle<External> external = Handle<External>::Cast(o->GetInternalField(0));
-    tv_set_dict(vimobj, static_cast<dict_T*>(external->Value()));
+#ifdef FEAT_FLOAT
+  if (v8obj->IsNumber()) {
+    tv_set_float(vimobj, v8obj->NumberValue());
     return true;
   }
+#endif
 
-  if (VimFunc->HasInstance(v8obj)) {
-    Handle<Object> o = Handle<Object>::Cast(v8obj);
-    Handle<External> external = Handle<External>::Cast(o->GetInternalField(0));
-    tv_set_func(vimobj, static_cast<char_u*>(external->Value()));
+  if (v8obj->IsString()) {
+    tv_set_v8string(vimobj, Handle<String>::Cast(v8obj));
     return true;
   }
 
@@ -446,20 +1104,38 @@ v8_to_vim(Handle<Value> v8obj, typval_T *vimobj, int depth, V8ToVimLookup *looku
     return true;
   }
 
-  if (v8obj->IsInt32()) {
-    tv_set_number(vimobj, v8obj->Int32Value());
+  if (v8obj->IsExternal()) {
+    *err = "v8_to_vim(): cannot convert native object";
+    return false;
+  }
+
+  if (!v8obj->IsObject()) {
+    *err = "v8_to_vim(): unknown type";
+    return false;
+  }
+
+  Local<FunctionTemplate> VimList = Local<FunctionTemplate>::New(isolate, p_VimList);
+  Local<FunctionTemplate> VimDict = Local<FunctionTemplate>::New(isolate, p_VimDict);
+  Local<FunctionTemplate> VimFunc = Local<FunctionTemplate>::New(isolate, p_VimFunc);
+
+  if (VimList->HasInstance(v8obj)) {
+    Handle<Object> o = Handle<Object>::Cast(v8obj);
+    Handle<External> external = Handle<External>::Cast(o->GetInternalField(0));
+    tv_set_list(vimobj, static_cast<list_T*>(external->Value()));
     return true;
   }
 
-#ifdef FEAT_FLOAT
-  if (v8obj->IsNumber()) {
-    tv_set_float(vimobj, v8obj->NumberValue());
+  if (VimDict->HasInstance(v8obj)) {
+    Handle<Object> o = Handle<Object>::Cast(v8obj);
+    Handle<External> external = Handle<External>::Cast(o->GetInternalField(0));
+    tv_set_dict(vimobj, static_cast<dict_T*>(external->Value()));
     return true;
   }
-#endif
 
-  if (v8obj->IsString()) {
-    tv_set_string(vimobj, (char_u*)(*String::Utf8Value(v8obj)));
+  if (VimFunc->HasInstance(v8obj)) {
+    Handle<Object> o = Handle<Object>::Cast(v8obj);
+    Handle<External> external = Handle<External>::Cast(o->GetInternalField(0));
+    tv_set_func(vimobj, static_cast<char_u*>(external->Value()));
     return true;
   }
 
@@ -468,29 +1144,29 @@ v8_to_vim(Handle<Value> v8obj, typval_T *vimobj, int depth, V8ToVimLookup *looku
     return true;
   }
 
-  if (v8obj->IsArray()) {
-    V8ToVimLookup::iterator it = lookup->get(v8obj);
-    if (it != lookup->end()) {
-      tv_set_list(vimobj, it->second.vval.v_list);
-      return true;
-    }
+  if (v8obj->IsTypedArray()) {
     list_T *list = list_alloc();
     if (list == NULL) {
       *err = "v8_to_vim(): list_alloc(): out of memoty";
       return false;
     }
-    Handle<Array> o = Handle<Array>::Cast(v8obj);
-    uint32_t len = o->Length();
-    lookup->set(v8obj, VimValue(list));
-    for (uint32_t i = 0; i < len; ++i) {
-      Handle<Value> v = o->Get(Integer::New(isolate, i));
+    Handle<TypedArray> o = Handle<TypedArray>::Cast(v8obj);
+    size_t len = o->Length();
+    bool isfloat = v8obj->IsFloat32Array() || v8obj->IsFloat64Array();
+    bool isuint32 = v8obj->IsUint32Array();
+    for (size_t i = 0; i < len; ++i) {
+      Handle<Value> v = o->Get(i);
       typval_T tv;
-      if (!v8_to_vim(v, &tv, depth + 1, lookup, err)) {
-        list_free(list, TRUE);
-        return false;
-      }
+#ifdef FEAT_FLOAT
+      if (isfloat)
+        tv_set_float(&tv, v->NumberValue());
+      else
+#endif
+      if (isuint32)
+        tv_set_number(&tv, (varnumber_T)v->Uint32Value());
+      else
+        tv_set_number(&tv, (varnumber_T)v->IntegerValue());
       if (!list_append_tv_nocopy(list, &tv)) {
-        clear_tv(&tv);
         list_free(list, TRUE);
         *err = "v8_to_vim(): list_append_tv_nocopy() error";
         return false;
@@ -500,119 +1176,551 @@ v8_to_vim(Handle<Value> v8obj, typval_T *vimobj, int depth, V8ToVimLookup *looku
     return true;
   }
 
-  if (v8obj->IsObject()) {
-    V8ToVimLookup::iterator it = lookup->get(v8obj);
+  if (v8obj->IsArray()) {
+    Handle<Array> o = Handle<Array>::Cast(v8obj);
+    V8Object key(o);
+    V8ToVimLookup::iterator it = lookup->get(key);
     if (it != lookup->end()) {
-      tv_set_dict(vimobj, it->second.vval.v_dict);
+      tv_set_list(vimobj, it->second.vval.v_list);
       return true;
     }
-    dict_T *dict = dict_alloc();
-    if (dict == NULL) {
-      *err = "v8_to_vim(): dict_alloc(): out of memory";
+    list_T *list = list_alloc();
+    if (list == NULL) {
+      *err = "v8_to_vim(): list_alloc(): out of memoty";
       return false;
     }
-    Handle<Object> o = Handle<Object>::Cast(v8obj);
-    Handle<Array> keys = o->GetPropertyNames();
-    uint32_t len = keys->Length();
-    lookup->set(v8obj, VimValue(dict));
+    uint32_t len = o->Length();
+    lookup->set(key, VimValue(list));
     for (uint32_t i = 0; i < len; ++i) {
-      Handle<Value> key = keys->Get(Integer::New(isolate, i));
-      Handle<Value> v = o->Get(key);
-      String::Utf8Value keystr(key);
+      Handle<Value> v = o->Get(i);
       typval_T tv;
-      if (keystr.length() == 0) {
-        dict_free(dict, TRUE);
-        *err = "v8_to_vim(): Cannot use empty key for Dictionary";
-        return false;
-      }
-      if (!v8_to_vim(v, &tv, depth + 1, lookup, err)) {
-        dict_free(dict, TRUE);
+      // Array of numbers is filled without recursion.
+      if (v->IsInt32())
+        tv_set_number(&tv, v->Int32Value());
+#ifdef FEAT_FLOAT
+      else if (v->IsNumber())
+        tv_set_float(&tv, v->NumberValue());
+#endif
+      else if (!v8_to_vim(v, &tv, depth + 1, lookup, err)) {
+        list_free(list, TRUE);
         return false;
       }
-      if (!dict_set_tv_nocopy(dict, (char_u*)*keystr, &tv)) {
+      if (!list_append_tv_nocopy(list, &tv)) {
         clear_tv(&tv);
-        dict_free(dict, TRUE);
-        *err = "v8_to_vim(): error dict_set_tv_nocopy()";
+        list_free(list, TRUE);
+        *err = "v8_to_vim(): list_append_tv_nocopy() error";
         return false;
       }
     }
-    tv_set_dict(vimobj, dict);
+    tv_set_list(vimobj, list);
     return true;
   }
 
-  if (v8obj->IsFunction()) {
-    *err = "v8_to_vim(): cannot convert function";
+  // Function is also converted to Dictionary of its properties.
+  Handle<Object> o = Handle<Object>::Cast(v8obj);
+  V8Object key(o);
+  V8ToVimLookup::iterator it = lookup->get(key);
+  if (it != lookup->end()) {
+    tv_set_dict(vimobj, it->second.vval.v_dict);
+    return true;
+  }
+  dict_T *dict = dict_alloc();
+  if (dict == NULL) {
+    *err = "v8_to_vim(): dict_alloc(): out of memory";
     return false;
   }
+  Handle<Array> keys = o->GetPropertyNames();
+  uint32_t len = keys->Length();
+  lookup->set(key, VimValue(dict));
+  for (uint32_t i = 0; i < len; ++i) {
+    Handle<Value> name = keys->Get(i);
+    Handle<Value> v = o->Get(name);
+    // Keys from GetPropertyNames() are unique, so the item is added
+    // without dict_find().
+    dictitem_T *di = dictitem_alloc_v8(name->ToString());
+    if (di == NULL) {
+      dict_free(dict, TRUE);
+      *err = "v8_to_vim(): dictitem_alloc(): out of memory";
+      return false;
+    }
+    if (di->di_key[0] == '\0') {
+      vim_free(di);
+      dict_free(dict, TRUE);
+      *err = "v8_to_vim(): Cannot use empty key for Dictionary";
+      return false;
+    }
+    if (!v8_to_vim(v, &di->di_tv, depth + 1, lookup, err)) {
+      vim_free(di);
+      dict_free(dict, TRUE);
+      return false;
+    }
+    if (dict_add(dict, di) == FAIL) {
+      dictitem_free(di);
+      dict_free(dict, TRUE);
+      *err = "v8_to_vim(): error dict_add()";
+      return false;
+    }
+  }
+  tv_set_dict(vimobj, dict);
+  return true;
+}
 
-  if (v8obj->IsExternal()) {
-    *err = "v8_to_vim(): cannot convert native object";
-    return false;
+// Large ASCII strings are handed to V8 as external one-byte strings.  The
+// data is a copy: Vim strings are not reference counted, so the Vim
+// allocation may be freed or changed while JavaScript still holds it.  A
+// memcpy is still much cheaper than UTF-8 decoding into the V8 heap.
+#define EXTERNAL_STRING_MIN (16 * 1024)
+
+class VimStringResource : public String::ExternalOneByteStringResource {
+public:
+  VimStringResource(char_u *data, size_t len) : _data(data), _len(len) {
+    isolate->AdjustAmountOfExternalAllocatedMemory(_len);
+  }
+  ~VimStringResource() {
+    isolate->AdjustAmountOfExternalAllocatedMemory(-(int64_t)_len);
+    vim_free(_data);
   }
+  const char *data() const { return (const char *)_data; }
+  size_t length() const { return _len; }
 
-  *err = "v8_to_vim(): unknown type";
-  return false;
-}
+private:
+  char_u *_data;
+  size_t _len;
+};
 
-static void
-weak_ref(typval_T *tv)
+static Handle<String>
+MakeV8String(char_u *str)
 {
-  TRACE("weak_ref");
-  char buf[64];
-  vim_snprintf(buf, sizeof(buf), (char*)"%p", tv);
-  dict_set_tv_nocopy(v_weak, (char_u*)buf, tv);
-}
+  size_t len = STRLEN(str);
+  if (len >= EXTERNAL_STRING_MIN) {
+    size_t i;
+    for (i = 0; i < len; ++i)
+      if (str[i] >= 0x80)
+        break;
+    if (i == len) {
+      char_u *copy = alloc((unsigned)len + 1);
+      if (copy != NULL) {
+        memcpy(copy, str, len + 1);
+        return String::NewExternal(isolate, new VimStringResource(copy, len));
+      }
+    }
+  }
+  return String::NewFromUtf8(isolate, (char *)str, String::kNormalString, (int)len);
+}
 
+// Like tv_set_string() but encode the string into Vim's allocation
+// directly instead of going through String::Utf8Value and vim_strsave().
 static void
-weak_unref(typval_T *tv)
+tv_set_v8string(typval_T *tv, Handle<String> str)
 {
-  TRACE("weak_unref");
-  char buf[64];
-  hashitem_T *hi;
-  dictitem_T *di;
-  vim_snprintf(buf, sizeof(buf), (char*)"%p", tv);
-  hi = hash_find(&v_weak->dv_hashtab, (char_u*)buf);
-  if (HASHITEM_EMPTY(hi)) {
-    emsg((char_u*)"if_v8: weak_unref(): internal error");
+  tv->v_type = VAR_STRING;
+  tv->v_lock = 0;
+  int len = str->Utf8Length();
+  char_u *p = alloc(len + 1);
+  if (p != NULL) {
+    str->WriteUtf8((char *)p, len, NULL, String::NO_NULL_TERMINATION);
+    p[len] = '\0';
+  }
+  tv->vval.v_string = p;
+}
+
+// Like dictitem_alloc() but encode the key into the item directly.
+static dictitem_T *
+dictitem_alloc_v8(Handle<String> key)
+{
+  int len = key->Utf8Length();
+  dictitem_T *di = (dictitem_T *)alloc((unsigned)(sizeof(dictitem_T) + len));
+  if (di != NULL) {
+    key->WriteUtf8((char *)di->di_key, len, NULL, String::NO_NULL_TERMINATION);
+    di->di_key[len] = '\0';
+    di->di_flags = 0;
+  }
+  return di;
+}
+
+// Property key cache
+//
+// Named property callbacks of VimDict get the same few keys again and
+// again.  The UTF-8 bytes and Vim's hash of recently used internalized
+// keys are kept with the V8 string, so that a hit neither allocates nor
+// encodes.  V8 has no identity hash for strings, so the set is chosen by
+// the length and the first and last characters, and the strings in the
+// set are compared by identity.
+
+#define KEYCACHE_SETS 64
+#define KEYCACHE_WAYS 4
+#define KEYCACHE_MAXLEN 63
+
+struct DictKey {
+  char_u *key;
+  hash_T hash;
+  char_u buf[KEYCACHE_MAXLEN + 1];
+  std::string longkey;          // when the key is longer than buf
+};
+
+struct KeyCacheSet {
+  struct {
+    Persistent<String> name;
+    char_u key[KEYCACHE_MAXLEN + 1];
+    hash_T hash;
+  } entries[KEYCACHE_WAYS];
+  int next;                     // entry to replace
+};
+
+static KeyCacheSet keycache[KEYCACHE_SETS];
+
+static unsigned long keycache_hits = 0;
+static unsigned long keycache_misses = 0;
+
+// Returns false for empty key.
+static bool
+GetDictKey(Handle<String> property, DictKey *k)
+{
+  int len = property->Length();
+  if (len == 0)
+    return false;
+  uint16_t first, last;
+  property->Write(&first, 0, 1, String::NO_NULL_TERMINATION);
+  property->Write(&last, len - 1, 1, String::NO_NULL_TERMINATION);
+  size_t h = (size_t)len * 31 + first * 7 + last;
+  KeyCacheSet *set = &keycache[h % KEYCACHE_SETS];
+
+  for (int i = 0; i < KEYCACHE_WAYS; ++i) {
+    if (!set->entries[i].name.IsEmpty() && set->entries[i].name == property) {
+      ++keycache_hits;
+      memcpy(k->buf, set->entries[i].key, sizeof(k->buf));
+      k->key = k->buf;
+      k->hash = set->entries[i].hash;
+      return true;
+    }
+  }
+
+  ++keycache_misses;
+  int n = property->Utf8Length();
+  if (n > KEYCACHE_MAXLEN) {
+    k->longkey.resize(n);
+    property->WriteUtf8(&k->longkey[0], n, NULL, String::NO_NULL_TERMINATION);
+    k->key = (char_u *)k->longkey.c_str();
+    k->hash = hash_hash(k->key);
+    return true;
+  }
+  property->WriteUtf8((char *)k->buf, n, NULL, String::NO_NULL_TERMINATION);
+  k->buf[n] = '\0';
+  k->key = k->buf;
+  k->hash = hash_hash(k->key);
+
+  // Only property names, which V8 internalizes, come again as the same
+  // string.  A computed key would evict an entry and never hit.  There is
+  // no IsInternalizedString() in the API: look the key up in the string
+  // table and compare the identity.
+  if (String::NewFromUtf8(isolate, (const char *)k->buf, String::kInternalizedString, n) != property)
+    return true;
+
+  int i = set->next;
+  set->next = (i + 1) % KEYCACHE_WAYS;
+  set->entries[i].name.Reset(isolate, property);
+  memcpy(set->entries[i].key, k->buf, sizeof(k->buf));
+  set->entries[i].hash = k->hash;
+  return true;
+}
+
+// Key of obj[index].  No V8 string is made.
+static void
+GetDictIndexKey(uint32_t index, DictKey *k)
+{
+  vim_snprintf((char *)k->buf, sizeof(k->buf), (char *)"%lu", (unsigned long)index);
+  k->key = k->buf;
+  k->hash = hash_hash(k->key);
+}
+
+// Links tv into v_pin.  The item shares the reference of tv; it doesn't
+// have its own.  Returns NULL when out of memory.
+static listitem_T *
+PinValue(typval_T *tv)
+{
+  listitem_T *li = listitem_alloc();
+  if (li == NULL)
+    return NULL;
+  li->li_tv = *tv;
+  list_append(v_pin, li);
+  return li;
+}
+
+// Unlinks li from v_pin.  The value is not cleared.
+static void
+UnpinValue(listitem_T *li)
+{
+  if (li == NULL)
     return;
+  list_remove(v_pin, li, li);
+  vim_free(li);
+}
+
+// Takes over the reference in tv and makes self a weak handle.  tv is
+// released when self is collected.
+static VimRef *
+VimRefNew(Handle<Object> self, typval_T *tv)
+{
+  VimRef *ref = new VimRef;
+  ref->tv = *tv;
+  ref->pin = (tv->v_type == VAR_FUNC) ? NULL : PinValue(&ref->tv);
+  ref->self.Reset(isolate, self);
+  ref->self.SetWeak(ref, VimRefDestroy);
+  objcache.set(ref->key(), ref);
+  return ref;
+}
+
+static void
+VimRefDestroy(const WeakCallbackData<Value, VimRef>& data)
+{
+  TRACE("VimRefDestroy");
+  VimRef *ref = data.GetParameter();
+  VimToV8Lookup::iterator it = objcache.get(ref->key());
+  if (it != objcache.end() && it->second == ref)
+    objcache.del(ref->key());
+  UnpinValue(ref->pin);
+  ref->self.Reset();
+  clear_tv(&ref->tv);
+  delete ref;
+}
+
+// Returns an empty handle when out of memory.
+static Handle<ArrayBuffer>
+ExternalBufferNew(size_t size, void **data)
+{
+  ExternalBuffer *eb = new ExternalBuffer;
+  eb->size = size;
+  eb->data = malloc(size == 0 ? 1 : size);
+  if (eb->data == NULL) {
+    delete eb;
+    return Handle<ArrayBuffer>();
   }
-  // XXX: save di because hash_remove() clear it.
-  di = HI2DI(hi);
-  hash_remove(&v_weak->dv_hashtab, hi);
-  vim_free(di);
+  Handle<ArrayBuffer> buf = ArrayBuffer::New(isolate, eb->data, size);
+  eb->self.Reset(isolate, buf);
+  eb->self.SetWeak(eb, ExternalBufferDestroy);
+  isolate->AdjustAmountOfExternalAllocatedMemory((int64_t)size);
+  *data = eb->data;
+  return buf;
+}
+
+static void
+ExternalBufferDestroy(const WeakCallbackData<ArrayBuffer, ExternalBuffer>& data)
+{
+  TRACE("ExternalBufferDestroy");
+  ExternalBuffer *eb = data.GetParameter();
+  isolate->AdjustAmountOfExternalAllocatedMemory(-(int64_t)eb->size);
+  eb->self.Reset();
+  free(eb->data);
+  delete eb;
 }
 
-// Reads a file into a v8 string.
+// Source file kept outside of the V8 heap.  The file is read into a
+// buffer with prefix and suffix around it, so that a module wrapper
+// doesn't need a concatenated copy.  The file is not mapped: it may be
+// written in place while V8 still holds the string for lazy compilation.
+class SourceFileResource : public String::ExternalOneByteStringResource {
+public:
+  SourceFileResource(char *data, size_t len) : _data(data), _len(len) {
+    isolate->AdjustAmountOfExternalAllocatedMemory(_len);
+  }
+  ~SourceFileResource() {
+    isolate->AdjustAmountOfExternalAllocatedMemory(-(int64_t)_len);
+    delete[] _data;
+  }
+  const char *data() const { return _data; }
+  size_t length() const { return _len; }
+
+private:
+  char *_data;
+  size_t _len;
+};
+
+// Reads a file into a v8 string: prefix + file + suffix.  The string is
+// external when the file is ASCII.  When cache_header is given, it is set
+// for the code cache of the whole string.
 static Handle<String>
-ReadFile(const char* name)
+ReadFile(const char* name, const char *prefix, const char *suffix, std::string *cache_header)
 {
   TRACE("ReadFile");
+  size_t plen = strlen(prefix);
+  size_t slen = strlen(suffix);
+
   FILE* file = fopen(name, "rb");
   if (file == NULL) return Handle<String>();
-
   fseek(file, 0, SEEK_END);
-  int size = ftell(file);
+  size_t size = ftell(file);
   rewind(file);
 
-  char* chars = new char[size + 1];
-  chars[size] = '\0';
-  for (int i = 0; i < size;) {
-    int read = fread(&chars[i], 1, size - i, file);
+  char *data = new char[plen + size + slen + 1];
+  for (size_t i = 0; i < size;) {
+    size_t read = fread(&data[plen + i], 1, size - i, file);
+    if (read == 0) {
+      size = i;
+      break;
+    }
     i += read;
   }
   fclose(file);
-  Handle<String> result = String::NewFromUtf8(isolate, chars, String::kNormalString, size);
-  delete[] chars;
+  memcpy(data, prefix, plen);
+  memcpy(data + plen + size, suffix, slen);
+  size_t len = plen + size + slen;
+
+  if (cache_header != NULL && !cache_dir.empty())
+    *cache_header = CodeCacheHeader(data, len);
+
+  bool ascii = true;
+  for (size_t i = plen; i < plen + size && ascii; ++i)
+    ascii = ((unsigned char)data[i] < 0x80);
+  if (ascii)
+    return String::NewExternal(isolate, new SourceFileResource(data, len));
+
+  Handle<String> result = String::NewFromUtf8(isolate, data, String::kNormalString, (int)len);
+  delete[] data;
   return result;
 }
 
+// FNV-1a (64bit)
+static unsigned long long
+hash_bytes(const char *p, size_t len)
+{
+  unsigned long long h = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; ++i)
+    h = (h ^ (unsigned char)p[i]) * 1099511628211ULL;
+  return h;
+}
+
+static std::string
+hex64(unsigned long long h)
+{
+  char buf[17];
+  for (int i = 15; i >= 0; --i, h >>= 4)
+    buf[i] = "0123456789abcdef"[h & 0xF];
+  buf[16] = '\0';
+  return buf;
+}
+
+// Code cache file is named after the script path, so an entry is replaced
+// when the script is modified.  The header identifies the source and the
+// V8 version the data was produced for; anything else is stale.
+//   "if_v8 code cache\n" <v8 version> "\n" <source hash> <source length> "\n"
+//   <data length> "\n" <data>
+static std::string
+CodeCachePath(const char *name, ScriptCacheMode mode)
+{
+  // load() and require() compile different sources from the same file
+  const char *ext = (mode == SCRIPT_CACHE_MODULE) ? ".module.bin" : ".bin";
+  return cache_dir + "/" + hex64(hash_bytes(name, strlen(name))) + ext;
+}
+
+static std::string
+CodeCacheHeader(const char *source, size_t len)
+{
+  std::ostringstream strm;
+  strm << "if_v8 code cache\n" << V8::GetVersion() << "\n"
+    << hex64(hash_bytes(source, len)) << " " << len << "\n";
+  return strm.str();
+}
+
+static bool
+ReadCodeCache(const std::string& path, const std::string& header, std::string *data)
+{
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == NULL)
+    return false;
+  std::string buf;
+  char chunk[8192];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    buf.append(chunk, n);
+  fclose(file);
+  if (buf.compare(0, header.size(), header) != 0)
+    return false;
+  size_t pos = buf.find('\n', header.size());
+  if (pos == std::string::npos)
+    return false;
+  unsigned long len = strtoul(buf.c_str() + header.size(), NULL, 10);
+  if (len == 0 || len != buf.size() - pos - 1)
+    return false;
+  *data = buf.substr(pos + 1);
+  return true;
+}
+
+static void
+WriteCodeCache(const std::string& path, const std::string& header, const ScriptCompiler::CachedData *cached)
+{
+  std::string tmp = path + ".tmp";
+  FILE *file = fopen(tmp.c_str(), "wb");
+  if (file == NULL)
+    return;
+  std::ostringstream strm;
+  strm << header << cached->length << "\n";
+  std::string head = strm.str();
+  bool ok = fwrite(head.data(), 1, head.size(), file) == head.size()
+    && fwrite(cached->data, 1, cached->length, file) == (size_t)cached->length;
+  if (fclose(file) != 0)
+    ok = false;
+  // rename() does not replace existing file on Windows.
+  remove(path.c_str());
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+    remove(tmp.c_str());
+}
+
+static Local<Script>
+CompileScript(Handle<String> source, Handle<Value> name, ScriptCacheMode mode, const std::string& cache_header)
+{
+  TRACE("CompileScript");
+  ScriptOrigin origin(name);
+
+  if (mode == SCRIPT_CACHE_MEMORY) {
+    std::string src = *String::Utf8Value(source);
+    Local<UnboundScript> unbound = scriptcache.get(src);
+    if (unbound.IsEmpty()) {
+      ScriptCompiler::Source s(source, origin);
+      unbound = ScriptCompiler::CompileUnbound(isolate, &s);
+      if (unbound.IsEmpty())
+        return Local<Script>();
+      scriptcache.set(src, unbound);
+    }
+    return unbound->BindToCurrentContext();
+  }
+
+  if ((mode == SCRIPT_CACHE_DISK || mode == SCRIPT_CACHE_MODULE) && !cache_dir.empty()) {
+    String::Utf8Value file(name);
+    std::string path = CodeCachePath(*file, mode);
+    std::string header = cache_header;
+    if (header.empty()) {
+      String::Utf8Value src(source);
+      header = CodeCacheHeader(*src, src.length());
+    }
+    std::string data;
+    if (ReadCodeCache(path, header, &data)) {
+      // CachedData is owned by Source.  V8 falls back to compiling when
+      // the data does not pass its own checks (flags, checksum); then the
+      // file is produced again below so that it is not rejected every time.
+      uint8_t *buf = new uint8_t[data.size()];
+      memcpy(buf, data.data(), data.size());
+      ScriptCompiler::Source s(source, origin, new ScriptCompiler::CachedData(buf, data.size(), ScriptCompiler::CachedData::BufferOwned));
+      Local<Script> script = ScriptCompiler::Compile(isolate, &s, ScriptCompiler::kConsumeCodeCache);
+      if (script.IsEmpty() || !s.GetCachedData()->rejected)
+        return script;
+    }
+    ScriptCompiler::Source s(source, origin);
+    Local<Script> script = ScriptCompiler::Compile(isolate, &s, ScriptCompiler::kProduceCodeCache);
+    if (!script.IsEmpty() && s.GetCachedData() != NULL)
+      WriteCodeCache(path, header, s.GetCachedData());
+    return script;
+  }
+
+  return Script::Compile(source, name->ToString());
+}
+
 static bool
-ExecuteString(Handle<String> source, Handle<Value> name, bool print_result, bool report_exceptions, std::string& err)
+ExecuteString(Handle<String> source, Handle<Value> name, bool print_result, bool report_exceptions, std::string& err, ScriptCacheMode mode, const std::string& cache_header)
 {
   TRACE("ExecuteString");
   HandleScope handle_scope(isolate);
   TryCatch try_catch;
-  Handle<Script> script = Script::Compile(source, name->ToString());
+  Handle<Script> script = CompileScript(source, name, mode, cache_header);
   if (script.IsEmpty()) {
     err = *(String::Utf8Value(try_catch.Exception()));
     if (report_exceptions)
@@ -688,148 +1796,1407 @@ vim_execute(const FunctionCallbackInfo<Value>& args)
   }
 }
 
-// The callback that is invoked by v8 whenever the JavaScript 'load'
-// function is called.  Loads, compiles and executes its argument
-// JavaScript file.
+// vim.call(func, args [, dict])
 static void
-Load(const FunctionCallbackInfo<Value>& args)
+vim_call(const FunctionCallbackInfo<Value>& args)
 {
-  TRACE("Load");
-  for (int i = 0; i < args.Length(); i++) {
-    HandleScope handle_scope(isolate);
-    String::Utf8Value file(args[i]);
-    Handle<String> source = ReadFile(*file);
-    if (source.IsEmpty()) {
-      isolate->ThrowException(String::NewFromUtf8(isolate, "Error loading file"));
-      return;
-    }
-    std::string err;
-    if (!ExecuteString(source, String::NewFromUtf8(isolate, *file), false, false, err)) {
-      isolate->ThrowException(String::NewFromUtf8(isolate, err.c_str()));
-      return;
-    }
-  }
-}
+  TRACE("vim_call");
+  HandleScope handle_scope(isolate);
 
-static list_T *makelistptr = NULL;
+  if (args.Length() < 2 || args.Length() > 3 || !args[1]->IsArray()) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "usage: vim.call(func, array args [, dict])"));
+    return;
+  }
 
-static Handle<Value>
-MakeVimList(list_T *list)
-{
-  TRACE("MakeVimList");
+  Local<FunctionTemplate> VimFunc = Local<FunctionTemplate>::New(isolate, p_VimFunc);
+  std::string name;
+  if (VimFunc->HasInstance(args[0])) {
+    Handle<Object> o = Handle<Object>::Cast(args[0]);
+    Handle<External> external = Handle<External>::Cast(o->GetInternalField(0));
+    name = static_cast<char *>(external->Value());
+  } else {
+    name = *String::Utf8Value(args[0]);
+  }
 
-  Local<FunctionTemplate> VimList = Local<FunctionTemplate>::New(isolate, p_VimList);
+  Handle<Array> arr = Handle<Array>::Cast(args[1]);
+  if (arr->Length() > MAX_FUNC_ARGS) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "vim.call(): too many arguments"));
+    return;
+  }
 
-  makelistptr = list;
-  Handle<Object> self = VimList->InstanceTemplate()->NewInstance();
-  makelistptr = NULL;
+  Handle<Value> argv[MAX_FUNC_ARGS];
+  int argc = arr->Length();
+  for (int i = 0; i < argc; ++i)
+    argv[i] = arr->Get(i);
 
-  return self;
+  Handle<Value> result;
+  std::string err;
+  if (!CallVimFunc((char_u*)name.c_str(), argc, argv, args.Length() == 3 ? args[2] : Handle<Value>::Cast(Undefined(isolate)), &result, &err)) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, err.c_str()));
+    return;
+  }
+  args.GetReturnValue().Set(result);
 }
 
+// vim.eval(expr)
 static void
-VimListDestroy(const WeakCallbackData<Value, typval_T>& data)
+vim_eval(const FunctionCallbackInfo<Value>& args)
 {
-  TRACE("VimListDestroy");
-  typval_T *tv = data.GetParameter();
+  TRACE("vim_eval");
+  HandleScope handle_scope(isolate);
 
-  objcache.del(VimValue(tv->vval.v_list));
+  if (args.Length() != 1 || !args[0]->IsString()) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "usage: vim.eval(string expr)"));
+    return;
+  }
 
-  weak_unref(tv);
+  String::Utf8Value expr(args[0]);
+  std::string err;
+  VimTryStart();
+  typval_T *tv = eval_expr((char_u*)*expr, NULL);
+  if (!VimTryEnd(&err)) {
+    if (tv != NULL)
+      free_tv(tv);
+    isolate->ThrowException(String::NewFromUtf8(isolate, err.c_str()));
+    return;
+  }
+  if (tv == NULL) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "vim.eval(): invalid expression"));
+    return;
+  }
+  Handle<Value> result;
+  bool ok = vim_to_v8(tv, &result, 1, &objcache, &err);
   free_tv(tv);
+  if (!ok) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, err.c_str()));
+    return;
+  }
+  args.GetReturnValue().Set(result);
+}
+
+// True for a variable name set_var() accepts: "name" or "x:name" with an
+// optional autoload "#".  Options, registers, environment variables and
+// indexes are left to :let.
+static bool
+is_plain_var_name(const char *name)
+{
+  const char *p = name;
+  if (name[0] != '\0' && name[1] == ':') {
+    if (strchr("gbwtlsav", name[0]) == NULL)
+      return false;
+    p += 2;
+  }
+  if (!(isalpha((unsigned char)*p) || *p == '_'))
+    return false;
+  for (++p; *p != '\0'; ++p)
+    if (!(isalnum((unsigned char)*p) || *p == '_' || *p == '#'))
+      return false;
+  return true;
 }
 
+// vim.let(name, value)
 static void
-VimListCreate(const FunctionCallbackInfo<Value>& args)
+vim_let(const FunctionCallbackInfo<Value>& args)
 {
-  TRACE("VimListCreate");
-  if (!args.IsConstructCall()) {
-    isolate->ThrowException(String::NewFromUtf8(isolate, "Cannot call constructor as function"));
+  TRACE("vim_let");
+  HandleScope handle_scope(isolate);
+
+  if (args.Length() != 2 || !args[0]->IsString()) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "usage: vim.let(string name, value)"));
     return;
   }
 
-  Handle<Object> self = args.Holder();
+  String::Utf8Value name(args[0]);
+  V8ToVimLookup lookup;
+  std::string err;
+  typval_T tv;
+  if (!v8_to_vim(args[1], &tv, 1, &lookup, &err)) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, err.c_str()));
+    return;
+  }
 
-  list_T *list;
-  if (makelistptr != NULL) {
-    list = makelistptr;
+  bool ok;
+  if (is_plain_var_name(*name)) {
+    // set_var() finds the scope (the current function for l: and a:) and
+    // does the checks of :let: read-only, lock, type and Funcref name.
+    // It takes over tv on success.
+    VimTryStart();
+    set_var((char_u*)*name, &tv, FALSE);
+    ok = VimTryEnd(&err);
+    clear_tv(&tv);
   } else {
-    list = list_alloc();
-    if (list == NULL) {
-      isolate->ThrowException(String::NewFromUtf8(isolate, "VimListCreate(): list_alloc(): out of memory"));
-      return;
-    }
+    dict_set_tv_nocopy(v_reg, (char_u*)"%v8_value%", &tv);
+    std::string cmd = std::string("let ") + *name + " = g:__if_v8['%v8_value%']";
+    VimTryStart();
+    do_cmdline_cmd((char_u*)cmd.c_str());
+    ok = VimTryEnd(&err);
+    typval_T zero;
+    tv_set_number(&zero, 0);
+    dict_set_tv_nocopy(v_reg, (char_u*)"%v8_value%", &zero);
   }
+  if (!ok)
+    isolate->ThrowException(String::NewFromUtf8(isolate, err.c_str()));
+}
 
-  self->SetInternalField(0, External::New(isolate, list));
+// vim.ListToArray(list [, type])
+// Shallow copy of list.  type is "Int32Array", "Uint32Array" or
+// "Float64Array" to get typed array for a list of numbers.
+static void
+vim_ListToArray(const FunctionCallbackInfo<Value>& args)
+{
+  TRACE("vim_ListToArray");
+  HandleScope handle_scope(isolate);
 
-  // increment Vim's reference count
-  typval_T *tv = alloc_tv();
-  tv_set_list(tv, list);
-  weak_ref(tv);
+  Local<FunctionTemplate> VimList = Local<FunctionTemplate>::New(isolate, p_VimList);
+  if (args.Length() < 1 || args.Length() > 2 || !VimList->HasInstance(args[0])) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "usage: vim.ListToArray(VimList list [, string type])"));
+    return;
+  }
+  Handle<External> external = Handle<External>::Cast(Handle<Object>::Cast(args[0])->GetInternalField(0));
+  list_T *list = static_cast<list_T*>(external->Value());
+  int len = list_len(list);
+  listitem_T *li;
+  int i;
 
-  // make weak reference
-  CopyableValuePersistent p = CopyableValuePersistent();
-  p.Reset(isolate, self);
-  p.SetWeak(tv, VimListDestroy);
+  std::string type;
+  if (args.Length() == 2)
+    type = *String::Utf8Value(args[1]);
 
-  objcache.set(VimValue(list), p);
+  if (type == "Int32Array" || type == "Uint32Array" || type == "Float64Array") {
+    bool isfloat = (type == "Float64Array");
+    for (li = list->lv_first; li != NULL; li = li->li_next) {
+#ifdef FEAT_FLOAT
+      if (li->li_tv.v_type == VAR_FLOAT && isfloat)
+        continue;
+#endif
+      if (li->li_tv.v_type != VAR_NUMBER) {
+        isolate->ThrowException(String::NewFromUtf8(isolate, "vim.ListToArray(): list contains non-number"));
+        return;
+      }
+    }
+    // Numbers are stored into the backing store in one pass.  Like the
+    // element conversion of typed arrays, integers wrap modulo 2^32.
+    void *data;
+    Handle<ArrayBuffer> buf = ExternalBufferNew(len * (isfloat ? sizeof(double) : sizeof(int32_t)), &data);
+    if (buf.IsEmpty()) {
+      isolate->ThrowException(String::NewFromUtf8(isolate, "vim.ListToArray(): out of memory"));
+      return;
+    }
+    Handle<TypedArray> arr;
+    if (type == "Int32Array") {
+      int32_t *p = static_cast<int32_t*>(data);
+      for (li = list->lv_first; li != NULL; li = li->li_next)
+        *p++ = (int32_t)(uint32_t)li->li_tv.vval.v_number;
+      arr = Int32Array::New(buf, 0, len);
+    } else if (type == "Uint32Array") {
+      uint32_t *p = static_cast<uint32_t*>(data);
+      for (li = list->lv_first; li != NULL; li = li->li_next)
+        *p++ = (uint32_t)li->li_tv.vval.v_number;
+      arr = Uint32Array::New(buf, 0, len);
+    } else {
+      double *p = static_cast<double*>(data);
+      for (li = list->lv_first; li != NULL; li = li->li_next) {
+#ifdef FEAT_FLOAT
+        if (li->li_tv.v_type == VAR_FLOAT)
+          *p++ = li->li_tv.vval.v_float;
+        else
+#endif
+          *p++ = (double)li->li_tv.vval.v_number;
+      }
+      arr = Float64Array::New(buf, 0, len);
+    }
+    args.GetReturnValue().Set(arr);
+    return;
+  } else if (!type.empty() && type != "Array") {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "vim.ListToArray(): unknown type"));
+    return;
+  }
 
-  args.GetReturnValue().Set(self);
+  Handle<Array> arr = Array::New(isolate, len);
+  std::string err;
+  for (li = list->lv_first, i = 0; li != NULL; li = li->li_next, ++i) {
+    Handle<Value> v;
+    if (!vim_to_v8(&li->li_tv, &v, 1, &objcache, &err)) {
+      isolate->ThrowException(String::NewFromUtf8(isolate, err.c_str()));
+      return;
+    }
+    arr->Set(i, v);
+  }
+  args.GetReturnValue().Set(arr);
 }
 
+// vim.ArrayToList(array)
 static void
-VimListGet(uint32_t index, const PropertyCallbackInfo<Value>& info)
+vim_ArrayToList(const FunctionCallbackInfo<Value>& args)
 {
-  TRACE("VimListGet");
-  Handle<Object> self = info.Holder();
-  Handle<External> external = Handle<External>::Cast(self->GetInternalField(0));
-  list_T *list = static_cast<list_T*>(external->Value());
-  listitem_T *li = list_find(list, index);
-  if (li == NULL)
+  TRACE("vim_ArrayToList");
+  HandleScope handle_scope(isolate);
+
+  if (args.Length() != 1 || !(args[0]->IsArray() || args[0]->IsTypedArray())) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "usage: vim.ArrayToList(Array array)"));
     return;
+  }
+  V8ToVimLookup lookup;
   std::string err;
-  Handle<Value> v8obj;
-  if (!vim_to_v8(&li->li_tv, &v8obj, 1, &objcache, &err)) {
+  typval_T tv;
+  if (!v8_to_vim(args[0], &tv, 1, &lookup, &err)) {
     isolate->ThrowException(String::NewFromUtf8(isolate, err.c_str()));
     return;
   }
-  info.GetReturnValue().Set(v8obj);
+  args.GetReturnValue().Set(MakeVimList(tv.vval.v_list));
+  clear_tv(&tv);
 }
 
+// vim.DictToObject(dict)
+// Shallow copy of dict.
 static void
-VimListSet(uint32_t index, Local<Value> value, const PropertyCallbackInfo<Value>& info)
+vim_DictToObject(const FunctionCallbackInfo<Value>& args)
 {
-  TRACE("VimListSet");
-  Handle<Object> self = info.Holder();
-  Handle<External> external = Handle<External>::Cast(self->GetInternalField(0));
-  list_T *list = static_cast<list_T*>(external->Value());
-  listitem_T *li = list_find(list, index);
-  if (li == NULL) {
-    isolate->ThrowException(String::NewFromUtf8(isolate, "list index out of range"));
+  TRACE("vim_DictToObject");
+  HandleScope handle_scope(isolate);
+
+  Local<FunctionTemplate> VimDict = Local<FunctionTemplate>::New(isolate, p_VimDict);
+  if (args.Length() != 1 || !VimDict->HasInstance(args[0])) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "usage: vim.DictToObject(VimDict dict)"));
     return;
   }
-  V8ToVimLookup lookup;
-  std::string err;
+  Handle<External> external = Handle<External>::Cast(Handle<Object>::Cast(args[0])->GetInternalField(0));
+  dict_T *dict = static_cast<dict_T*>(external->Value());
+  hashtab_T *ht = &dict->dv_hashtab;
+  long_u todo = ht->ht_used;
+  hashitem_T *hi;
+  Handle<Object> obj = Object::New(isolate);
+  std::string err;
+  for (hi = ht->ht_array; todo > 0; ++hi) {
+    if (!HASHITEM_EMPTY(hi)) {
+      --todo;
+      Handle<Value> v;
+      if (!vim_to_v8(&HI2DI(hi)->di_tv, &v, 1, &objcache, &err)) {
+        isolate->ThrowException(String::NewFromUtf8(isolate, err.c_str()));
+        return;
+      }
+      obj->Set(String::NewFromUtf8(isolate, (char *)hi->hi_key), v);
+    }
+  }
+  args.GetReturnValue().Set(obj);
+}
+
+// vim.ObjectToDict(object)
+static void
+vim_ObjectToDict(const FunctionCallbackInfo<Value>& args)
+{
+  TRACE("vim_ObjectToDict");
+  HandleScope handle_scope(isolate);
+
+  if (args.Length() != 1 || !args[0]->IsObject() || args[0]->IsArray() || args[0]->IsFunction()) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "usage: vim.ObjectToDict(Object object)"));
+    return;
+  }
+  V8ToVimLookup lookup;
+  std::string err;
+  typval_T tv;
+  if (!v8_to_vim(args[0], &tv, 1, &lookup, &err)) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, err.c_str()));
+    return;
+  }
+  if (tv.v_type != VAR_DICT) {
+    clear_tv(&tv);
+    isolate->ThrowException(String::NewFromUtf8(isolate, "vim.ObjectToDict(): not an Object"));
+    return;
+  }
+  args.GetReturnValue().Set(MakeVimDict(tv.vval.v_dict));
+  clear_tv(&tv);
+}
+
+// JSON
+//
+// vim.json.encode() and vim.json.decode() convert between typval_T and
+// JSON text without going through V8 objects.  Runs of plain string bytes
+// are scanned 8 bytes at a time.
+
+#define JSON_MAX_DEPTH 1000
+
+// True when one of the 8 bytes is a control character, '"' or '\\'.
+static inline bool
+json_special8(const char *p)
+{
+  const uint64_t ones = 0x0101010101010101ULL;
+  const uint64_t high = 0x8080808080808080ULL;
+  uint64_t w;
+  memcpy(&w, p, 8);
+  uint64_t ctrl = (w - ones * 0x20) & ~w & high;
+  uint64_t q = w ^ (ones * '"');
+  q = (q - ones) & ~q & high;
+  uint64_t b = w ^ (ones * '\\');
+  b = (b - ones) & ~b & high;
+  return (ctrl | q | b) != 0;
+}
+
+static bool
+json_is_ascii(const char *p, const char *end)
+{
+  const uint64_t high = 0x8080808080808080ULL;
+  for (; end - p >= 8; p += 8) {
+    uint64_t w;
+    memcpy(&w, p, 8);
+    if (w & high)
+      return false;
+  }
+  for (; p < end; ++p)
+    if ((unsigned char)*p >= 0x80)
+      return false;
+  return true;
+}
+
+// Returns the first control character, '"' or '\\' in [p, end).
+static const char *
+json_scan_plain(const char *p, const char *end)
+{
+  while (end - p >= 8 && !json_special8(p))
+    p += 8;
+  while (p < end && (unsigned char)*p >= 0x20 && *p != '"' && *p != '\\')
+    ++p;
+  return p;
+}
+
+static void
+json_encode_string(const char_u *s, std::string *out)
+{
+  out->push_back('"');
+  if (s != NULL) {
+    const char *p = (const char *)s;
+    const char *end = p + strlen(p);
+    while (p < end) {
+      const char *q = json_scan_plain(p, end);
+      out->append(p, q - p);
+      if (q == end)
+        break;
+      unsigned char c = *q;
+      switch (c) {
+      case '"': out->append("\\\""); break;
+      case '\\': out->append("\\\\"); break;
+      case '\b': out->append("\\b"); break;
+      case '\f': out->append("\\f"); break;
+      case '\n': out->append("\\n"); break;
+      case '\r': out->append("\\r"); break;
+      case '\t': out->append("\\t"); break;
+      default: {
+        char buf[8];
+        snprintf(buf, sizeof(buf), "\\u%04x", c);
+        out->append(buf);
+      }
+      }
+      p = q + 1;
+    }
+  }
+  out->push_back('"');
+}
+
+// path holds the Lists and Dictionaries being encoded, to detect cycles.
+static bool
+json_encode(typval_T *tv, std::string *out, std::vector<void *> *path, std::string *err)
+{
+  char buf[64];
+  switch (tv->v_type) {
+  case VAR_NUMBER:
+    snprintf(buf, sizeof(buf), "%ld", (long)tv->vval.v_number);
+    out->append(buf);
+    return true;
+#ifdef FEAT_FLOAT
+  case VAR_FLOAT:
+    // same as JSON.stringify()
+    if (tv->vval.v_float != tv->vval.v_float
+        || tv->vval.v_float - tv->vval.v_float != 0) {
+      out->append("null");
+      return true;
+    }
+    // shortest form that reads back the same
+    for (int prec = 15; prec <= 17; ++prec) {
+      snprintf(buf, sizeof(buf), "%.*g", prec, tv->vval.v_float);
+      if (strtod(buf, NULL) == tv->vval.v_float)
+        break;
+    }
+    out->append(buf);
+    return true;
+#endif
+  case VAR_STRING:
+    json_encode_string(tv->vval.v_string, out);
+    return true;
+  case VAR_FUNC:
+    *err = "vim.json.encode(): cannot encode Funcref";
+    return false;
+  case VAR_LIST:
+  case VAR_DICT:
+    break;
+  default:
+    *err = "vim.json.encode(): unknown type";
+    return false;
+  }
+
+  void *container = (tv->v_type == VAR_LIST) ? (void *)tv->vval.v_list : (void *)tv->vval.v_dict;
+  if (container == NULL) {
+    out->append(tv->v_type == VAR_LIST ? "[]" : "{}");
+    return true;
+  }
+  if (path->size() >= JSON_MAX_DEPTH) {
+    *err = "vim.json.encode(): too deep";
+    return false;
+  }
+  if (std::find(path->begin(), path->end(), container) != path->end()) {
+    *err = "vim.json.encode(): circular reference";
+    return false;
+  }
+  path->push_back(container);
+
+  if (tv->v_type == VAR_LIST) {
+    out->push_back('[');
+    for (listitem_T *li = tv->vval.v_list->lv_first; li != NULL; li = li->li_next) {
+      if (li != tv->vval.v_list->lv_first)
+        out->push_back(',');
+      if (!json_encode(&li->li_tv, out, path, err))
+        return false;
+    }
+    out->push_back(']');
+  } else {
+    hashtab_T *ht = &tv->vval.v_dict->dv_hashtab;
+    long_u todo = ht->ht_used;
+    bool first = true;
+    out->push_back('{');
+    for (hashitem_T *hi = ht->ht_array; todo > 0; ++hi) {
+      if (HASHITEM_EMPTY(hi))
+        continue;
+      --todo;
+      if (!first)
+        out->push_back(',');
+      first = false;
+      json_encode_string(hi->hi_key, out);
+      out->push_back(':');
+      if (!json_encode(&HI2DI(hi)->di_tv, out, path, err))
+        return false;
+    }
+    out->push_back('}');
+  }
+
+  path->pop_back();
+  return true;
+}
+
+class JsonParser {
+public:
+  JsonParser(const char *p, const char *end, std::string *err)
+    : _begin(p), _p(p), _end(end), _err(err) {}
+
+  // Parses the whole text.
+  bool parse(typval_T *tv) {
+    if (!value(tv, 0))
+      return false;
+    skip_space();
+    if (_p != _end) {
+      clear_tv(tv);
+      return error("unexpected data after value");
+    }
+    return true;
+  }
+
+private:
+  bool error(const char *msg) {
+    std::ostringstream strm;
+    strm << "vim.json.decode(): " << msg << " at " << (_p - _begin);
+    *_err = strm.str();
+    return false;
+  }
+
+  void skip_space() {
+    while (_p < _end && (*_p == ' ' || *_p == '\t' || *_p == '\n' || *_p == '\r'))
+      ++_p;
+  }
+
+  bool literal(const char *word, varnumber_T n, typval_T *tv) {
+    size_t len = strlen(word);
+    if ((size_t)(_end - _p) < len || memcmp(_p, word, len) != 0)
+      return error("invalid literal");
+    _p += len;
+    tv_set_number(tv, n);
+    return true;
+  }
+
+  bool value(typval_T *tv, int depth) {
+    if (depth > JSON_MAX_DEPTH)
+      return error("too deep");
+    skip_space();
+    if (_p == _end)
+      return error("unexpected end of data");
+    switch (*_p) {
+    case '{': return object(tv, depth);
+    case '[': return array(tv, depth);
+    case '"': {
+      char_u *s;
+      if (!string(&s))
+        return false;
+      tv->v_type = VAR_STRING;
+      tv->v_lock = 0;
+      tv->vval.v_string = s;
+      return true;
+    }
+    case 't': return literal("true", 1, tv);
+    case 'f': return literal("false", 0, tv);
+    case 'n': return literal("null", 0, tv);
+    default: return number(tv);
+    }
+  }
+
+  bool number(typval_T *tv) {
+    const char *start = _p;
+    bool isfloat = false;
+    if (_p < _end && *_p == '-')
+      ++_p;
+    if (_p < _end && *_p == '0')
+      ++_p;
+    else if (_p < _end && *_p >= '1' && *_p <= '9')
+      while (_p < _end && isdigit((unsigned char)*_p))
+        ++_p;
+    else
+      return error("invalid value");
+    if (_p < _end && *_p == '.') {
+      isfloat = true;
+      ++_p;
+      if (_p == _end || !isdigit((unsigned char)*_p))
+        return error("invalid number");
+      while (_p < _end && isdigit((unsigned char)*_p))
+        ++_p;
+    }
+    if (_p < _end && (*_p == 'e' || *_p == 'E')) {
+      isfloat = true;
+      ++_p;
+      if (_p < _end && (*_p == '+' || *_p == '-'))
+        ++_p;
+      if (_p == _end || !isdigit((unsigned char)*_p))
+        return error("invalid number");
+      while (_p < _end && isdigit((unsigned char)*_p))
+        ++_p;
+    }
+    std::string text(start, _p - start);
+    if (!isfloat) {
+      errno = 0;
+      long n = strtol(text.c_str(), NULL, 10);
+      if (errno == 0 && n == (varnumber_T)n) {
+        tv_set_number(tv, (varnumber_T)n);
+        return true;
+      }
+    }
+#ifdef FEAT_FLOAT
+    tv_set_float(tv, strtod(text.c_str(), NULL));
+    return true;
+#else
+    return error("number is too large");
+#endif
+  }
+
+  static int hexval(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  }
+
+  bool hex4(unsigned *u) {
+    if (_end - _p < 4)
+      return error("invalid \\u escape");
+    *u = 0;
+    for (int i = 0; i < 4; ++i) {
+      int h = hexval(_p[i]);
+      if (h < 0)
+        return error("invalid \\u escape");
+      *u = (*u << 4) | h;
+    }
+    _p += 4;
+    return true;
+  }
+
+  static void append_utf8(std::string *s, unsigned c) {
+    if (c < 0x80) {
+      s->push_back((char)c);
+    } else if (c < 0x800) {
+      s->push_back((char)(0xC0 | (c >> 6)));
+      s->push_back((char)(0x80 | (c & 0x3F)));
+    } else if (c < 0x10000) {
+      s->push_back((char)(0xE0 | (c >> 12)));
+      s->push_back((char)(0x80 | ((c >> 6) & 0x3F)));
+      s->push_back((char)(0x80 | (c & 0x3F)));
+    } else {
+      s->push_back((char)(0xF0 | (c >> 18)));
+      s->push_back((char)(0x80 | ((c >> 12) & 0x3F)));
+      s->push_back((char)(0x80 | ((c >> 6) & 0x3F)));
+      s->push_back((char)(0x80 | (c & 0x3F)));
+    }
+  }
+
+  // Returns allocated string.
+  bool string(char_u **result) {
+    ++_p;       // '"'
+    const char *q = json_scan_plain(_p, _end);
+    if (q < _end && *q == '"') {
+      // no escape
+      *result = vim_strnsave((char_u *)_p, (int)(q - _p));
+      _p = q + 1;
+      return true;
+    }
+    std::string s;
+    for (;;) {
+      q = json_scan_plain(_p, _end);
+      s.append(_p, q - _p);
+      _p = q;
+      if (_p == _end)
+        return error("unterminated string");
+      if (*_p == '"')
+        break;
+      if (*_p != '\\')
+        return error("control character in string");
+      if (++_p == _end)
+        return error("unterminated string");
+      char c = *_p++;
+      switch (c) {
+      case '"': s.push_back('"'); break;
+      case '\\': s.push_back('\\'); break;
+      case '/': s.push_back('/'); break;
+      case 'b': s.push_back('\b'); break;
+      case 'f': s.push_back('\f'); break;
+      case 'n': s.push_back('\n'); break;
+      case 'r': s.push_back('\r'); break;
+      case 't': s.push_back('\t'); break;
+      case 'u': {
+        unsigned u;
+        if (!hex4(&u))
+          return false;
+        if (u >= 0xD800 && u <= 0xDBFF && _end - _p >= 6 && _p[0] == '\\' && _p[1] == 'u') {
+          _p += 2;
+          unsigned lo;
+          if (!hex4(&lo))
+            return false;
+          if (lo >= 0xDC00 && lo <= 0xDFFF)
+            u = 0x10000 + ((u - 0xD800) << 10) + (lo - 0xDC00);
+          else {
+            append_utf8(&s, u);
+            u = lo;
+          }
+        }
+        if (u == 0)
+          return error("NUL in string");
+        append_utf8(&s, u);
+        break;
+      }
+      default:
+        return error("invalid escape");
+      }
+    }
+    ++_p;       // '"'
+    *result = vim_strnsave((char_u *)s.data(), (int)s.size());
+    return true;
+  }
+
+  bool array(typval_T *tv, int depth) {
+    ++_p;       // '['
+    list_T *list = list_alloc();
+    if (list == NULL)
+      return error("out of memory");
+    tv_set_list(tv, list);
+    skip_space();
+    if (_p < _end && *_p == ']') {
+      ++_p;
+      return true;
+    }
+    for (;;) {
+      typval_T item;
+      if (!value(&item, depth + 1)) {
+        clear_tv(tv);
+        return false;
+      }
+      if (!list_append_tv_nocopy(list, &item)) {
+        clear_tv(&item);
+        clear_tv(tv);
+        return error("out of memory");
+      }
+      skip_space();
+      if (_p < _end && *_p == ',') {
+        ++_p;
+      } else if (_p < _end && *_p == ']') {
+        ++_p;
+        return true;
+      } else {
+        clear_tv(tv);
+        return error("expected ',' or ']'");
+      }
+    }
+  }
+
+  bool object(typval_T *tv, int depth) {
+    ++_p;       // '{'
+    dict_T *dict = dict_alloc();
+    if (dict == NULL)
+      return error("out of memory");
+    tv_set_dict(tv, dict);
+    skip_space();
+    if (_p < _end && *_p == '}') {
+      ++_p;
+      return true;
+    }
+    for (;;) {
+      skip_space();
+      char_u *key;
+      if (_p == _end || *_p != '"') {
+        clear_tv(tv);
+        return error("expected string key");
+      }
+      if (!string(&key)) {
+        clear_tv(tv);
+        return false;
+      }
+      if (*key == '\0') {
+        vim_free(key);
+        clear_tv(tv);
+        return error("cannot use empty key for Dictionary");
+      }
+      skip_space();
+      if (_p == _end || *_p != ':') {
+        vim_free(key);
+        clear_tv(tv);
+        return error("expected ':'");
+      }
+      ++_p;
+      typval_T item;
+      if (!value(&item, depth + 1)) {
+        vim_free(key);
+        clear_tv(tv);
+        return false;
+      }
+      // the last one wins for duplicated keys
+      int ok = dict_set_tv_nocopy(dict, key, &item);
+      vim_free(key);
+      if (!ok) {
+        clear_tv(&item);
+        clear_tv(tv);
+        return error("out of memory");
+      }
+      skip_space();
+      if (_p < _end && *_p == ',') {
+        ++_p;
+      } else if (_p < _end && *_p == '}') {
+        ++_p;
+        return true;
+      } else {
+        clear_tv(tv);
+        return error("expected ',' or '}'");
+      }
+    }
+  }
+
+  const char *_begin;
+  const char *_p;
+  const char *_end;
+  std::string *_err;
+};
+
+// vim.json.encode(value)
+// VimList and VimDict are encoded without copy.
+static void
+vim_jsonEncode(const FunctionCallbackInfo<Value>& args)
+{
+  TRACE("vim_jsonEncode");
+  HandleScope handle_scope(isolate);
+  if (args.Length() != 1) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "usage: vim.json.encode(value)"));
+    return;
+  }
+  V8ToVimLookup lookup;
+  std::string err;
+  typval_T tv;
+  if (!v8_to_vim(args[0], &tv, 1, &lookup, &err)) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, err.c_str()));
+    return;
+  }
+  std::string out;
+  std::vector<void *> path;
+  bool ok = json_encode(&tv, &out, &path, &err);
+  clear_tv(&tv);
+  if (!ok) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, err.c_str()));
+    return;
+  }
+  args.GetReturnValue().Set(String::NewFromUtf8(isolate, out.data(), String::kNormalString, (int)out.size()));
+}
+
+// vim.json.decode(text)
+// Returns VimList or VimDict for array or object.
+static void
+vim_jsonDecode(const FunctionCallbackInfo<Value>& args)
+{
+  TRACE("vim_jsonDecode");
+  HandleScope handle_scope(isolate);
+  if (args.Length() != 1 || !args[0]->IsString()) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "usage: vim.json.decode(string text)"));
+    return;
+  }
+  Handle<String> str = Handle<String>::Cast(args[0]);
+  std::string err;
+  typval_T tv;
+  bool ok;
+  const String::ExternalOneByteStringResource *r = NULL;
+  if (str->IsExternalOneByte())
+    r = str->GetExternalOneByteStringResource();
+  if (r != NULL && json_is_ascii(r->data(), r->data() + r->length())) {
+    // large string from Vim: parse in place
+    JsonParser parser(r->data(), r->data() + r->length(), &err);
+    ok = parser.parse(&tv);
+  } else {
+    String::Utf8Value text(str);
+    JsonParser parser(*text, *text + text.length(), &err);
+    ok = parser.parse(&tv);
+  }
+  if (!ok) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, err.c_str()));
+    return;
+  }
+  Handle<Value> result;
+  ok = vim_to_v8(&tv, &result, 1, &objcache, &err);
+  clear_tv(&tv);
+  if (!ok) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, err.c_str()));
+    return;
+  }
+  args.GetReturnValue().Set(result);
+}
+
+// vim.heapStats()
+static void
+vim_heapStats(const FunctionCallbackInfo<Value>& args)
+{
+  TRACE("vim_heapStats");
+  HeapStatistics stats;
+  isolate->GetHeapStatistics(&stats);
+  Handle<Object> obj = Object::New(isolate);
+  obj->Set(String::NewFromUtf8(isolate, "totalHeapSize"), Number::New(isolate, (double)stats.total_heap_size()));
+  obj->Set(String::NewFromUtf8(isolate, "totalHeapSizeExecutable"), Number::New(isolate, (double)stats.total_heap_size_executable()));
+  obj->Set(String::NewFromUtf8(isolate, "totalPhysicalSize"), Number::New(isolate, (double)stats.total_physical_size()));
+  obj->Set(String::NewFromUtf8(isolate, "usedHeapSize"), Number::New(isolate, (double)stats.used_heap_size()));
+  obj->Set(String::NewFromUtf8(isolate, "heapSizeLimit"), Number::New(isolate, (double)stats.heap_size_limit()));
+  // returns current amount without changing it
+  obj->Set(String::NewFromUtf8(isolate, "externalMemory"), Number::New(isolate, (double)isolate->AdjustAmountOfExternalAllocatedMemory(0)));
+  obj->Set(String::NewFromUtf8(isolate, "processMemory"), Number::New(isolate, (double)ProcessMemory()));
+  obj->Set(String::NewFromUtf8(isolate, "wrappers"), Number::New(isolate, (double)objcache.size()));
+  obj->Set(String::NewFromUtf8(isolate, "pinned"), Number::New(isolate, (double)list_len(v_pin)));
+  obj->Set(String::NewFromUtf8(isolate, "scripts"), Number::New(isolate, (double)scriptcache.size()));
+  obj->Set(String::NewFromUtf8(isolate, "terminated"), Number::New(isolate, (double)terminated_count));
+  obj->Set(String::NewFromUtf8(isolate, "interrupted"), Number::New(isolate, (double)interrupted_count));
+  obj->Set(String::NewFromUtf8(isolate, "keyCacheHits"), Number::New(isolate, (double)keycache_hits));
+  obj->Set(String::NewFromUtf8(isolate, "keyCacheMisses"), Number::New(isolate, (double)keycache_misses));
+  args.GetReturnValue().Set(obj);
+}
+
+// Same as :try.  Errors raised by Vim while trylevel is non-zero are
+// collected in msg_list or thrown as exception instead of being displayed.
+static void
+VimTryStart()
+{
+  ++trylevel;
+}
+
+// Same as :endtry.  Returns false and sets err when the Vim code failed.
+static bool
+VimTryEnd(std::string *err)
+{
+  --trylevel;
+  did_emsg = FALSE;
+  if (got_int) {
+    if (did_throw)
+      discard_current_exception();
+    got_int = FALSE;
+    *err = "Vim:Interrupt";
+    return false;
+  } else if (msg_list != NULL && *msg_list != NULL) {
+    *err = (char *)(*msg_list)->msg;
+    free_global_msglist();
+    if (did_throw)
+      discard_current_exception();
+    return false;
+  } else if (did_throw) {
+    *err = (char *)current_exception->value;
+    discard_current_exception();
+    return false;
+  }
+  return true;
+}
+
+// Call Vim function without going through Ex command.  Arguments are
+// converted into a list on the stack; func_call() copies them for the
+// callee.
+static bool
+CallVimFunc(char_u *name, int argc, Handle<Value> *argv, Handle<Value> self, Handle<Value> *result, std::string *err)
+{
+  TRACE("CallVimFunc");
+  listitem_T items[MAX_FUNC_ARGS];
+  list_T list;
+  typval_T argvars;
+  typval_T rettv;
+  dict_T *selfdict = NULL;
+  V8ToVimLookup lookup;
+
+  memset(&list, 0, sizeof(list));
+  list.lv_refcount = 1;
+
+  bool ok = true;
+  for (int i = 0; ok && i < argc; ++i) {
+    ok = v8_to_vim(argv[i], &items[i].li_tv, 1, &lookup, err);
+    if (ok)
+      list_append(&list, &items[i]);
+  }
+
+  if (ok && !self.IsEmpty() && !self->IsUndefined()) {
+    Local<FunctionTemplate> VimDict = Local<FunctionTemplate>::New(isolate, p_VimDict);
+    if (VimDict->HasInstance(self)) {
+      Handle<External> external = Handle<External>::Cast(Handle<Object>::Cast(self)->GetInternalField(0));
+      selfdict = static_cast<dict_T*>(external->Value());
+    } else {
+      *err = "CallVimFunc(): self is not a Dictionary";
+      ok = false;
+    }
+  }
+
+  if (ok) {
+    argvars.v_type = VAR_LIST;
+    argvars.v_lock = 0;
+    argvars.vval.v_list = &list;
+    rettv.v_type = VAR_UNKNOWN;
+    VimTryStart();
+    int r = func_call(name, &argvars, selfdict, &rettv);
+    if (!VimTryEnd(err))
+      ok = false;
+    else if (r == FAIL) {
+      *err = std::string("CallVimFunc(): cannot call function: ") + (char *)name;
+      ok = false;
+    } else
+      ok = vim_to_v8(&rettv, result, 1, &objcache, err);
+    clear_tv(&rettv);
+  }
+
+  for (listitem_T *li = list.lv_first; li != NULL; li = li->li_next)
+    clear_tv(&li->li_tv);
+
+  return ok;
+}
+
+// The callback that is invoked by v8 whenever the JavaScript 'load'
+// function is called.  Loads, compiles and executes its argument
+// JavaScript file.
+static void
+Load(const FunctionCallbackInfo<Value>& args)
+{
+  TRACE("Load");
+  for (int i = 0; i < args.Length(); i++) {
+    HandleScope handle_scope(isolate);
+    String::Utf8Value file(args[i]);
+    std::string header;
+    Handle<String> source = ReadFile(*file, "", "", &header);
+    if (source.IsEmpty()) {
+      isolate->ThrowException(String::NewFromUtf8(isolate, "Error loading file"));
+      return;
+    }
+    std::string err;
+    if (!ExecuteString(source, String::NewFromUtf8(isolate, *file), false, false, err, SCRIPT_CACHE_DISK, header)) {
+      isolate->ThrowException(String::NewFromUtf8(isolate, err.c_str()));
+      return;
+    }
+  }
+}
+
+// vim._compileModule(filename)
+// Returns the module function of a CommonJS module:
+//   function (exports, require, module, __filename, __dirname)
+// The wrapper is on the first line, so line numbers are not changed.
+#define MODULE_PREFIX "(function (exports, require, module, __filename, __dirname) {"
+#define MODULE_SUFFIX "\n})"
+
+static void
+vim_compileModule(const FunctionCallbackInfo<Value>& args)
+{
+  TRACE("vim_compileModule");
+  HandleScope handle_scope(isolate);
+  if (args.Length() != 1 || !args[0]->IsString()) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "usage: vim._compileModule(string filename)"));
+    return;
+  }
+  String::Utf8Value file(args[0]);
+  std::string header;
+  Handle<String> source = ReadFile(*file, MODULE_PREFIX, MODULE_SUFFIX, &header);
+  if (source.IsEmpty()) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "Error loading file"));
+    return;
+  }
+  // exception is propagated to the caller
+  Local<Script> script = CompileScript(source, args[0], SCRIPT_CACHE_MODULE, header);
+  if (script.IsEmpty())
+    return;
+  Handle<Value> func = script->Run();
+  if (func.IsEmpty())
+    return;
+  args.GetReturnValue().Set(func);
+}
+
+static list_T *makelistptr = NULL;
+
+static Handle<Value>
+MakeVimList(list_T *list)
+{
+  TRACE("MakeVimList");
+
+  Local<FunctionTemplate> VimList = Local<FunctionTemplate>::New(isolate, p_VimList);
+
+  makelistptr = list;
+  Handle<Object> self = VimList->InstanceTemplate()->NewInstance();
+  makelistptr = NULL;
+
+  return self;
+}
+
+static void
+VimListCreate(const FunctionCallbackInfo<Value>& args)
+{
+  TRACE("VimListCreate");
+  if (!args.IsConstructCall()) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "Cannot call constructor as function"));
+    return;
+  }
+
+  Handle<Object> self = args.Holder();
+
+  list_T *list;
+  if (makelistptr != NULL) {
+    list = makelistptr;
+  } else {
+    list = list_alloc();
+    if (list == NULL) {
+      isolate->ThrowException(String::NewFromUtf8(isolate, "VimListCreate(): list_alloc(): out of memory"));
+      return;
+    }
+  }
+
+  self->SetInternalField(0, External::New(isolate, list));
+
+  // increment Vim's reference count
+  typval_T tv;
+  tv_set_list(&tv, list);
+  VimRefNew(self, &tv);
+
+  args.GetReturnValue().Set(self);
+}
+
+static void
+VimListGet(uint32_t index, const PropertyCallbackInfo<Value>& info)
+{
+  TRACE("VimListGet");
+  Handle<Object> self = info.Holder();
+  Handle<External> external = Handle<External>::Cast(self->GetInternalField(0));
+  list_T *list = static_cast<list_T*>(external->Value());
+  listitem_T *li = list_find(list, index);
+  if (li == NULL)
+    return;
+  std::string err;
+  Handle<Value> v8obj;
+  if (!vim_to_v8(&li->li_tv, &v8obj, 1, &objcache, &err)) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, err.c_str()));
+    return;
+  }
+  info.GetReturnValue().Set(v8obj);
+}
+
+static void
+VimListSet(uint32_t index, Local<Value> value, const PropertyCallbackInfo<Value>& info)
+{
+  TRACE("VimListSet");
+  Handle<Object> self = info.Holder();
+  Handle<External> external = Handle<External>::Cast(self->GetInternalField(0));
+  list_T *list = static_cast<list_T*>(external->Value());
+  listitem_T *li = list_find(list, index);
+  if (li == NULL) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "list index out of range"));
+    return;
+  }
+  V8ToVimLookup lookup;
+  std::string err;
+  typval_T vimobj;
+  if (!v8_to_vim(value, &vimobj, 1, &lookup, &err)) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, err.c_str()));
+    return;
+  }
+  clear_tv(&li->li_tv);
+  li->li_tv = vimobj;
+  info.GetReturnValue().Set(value);
+}
+
+static void
+VimListQuery(uint32_t index, const PropertyCallbackInfo<Integer>& info)
+{
+  TRACE("VimListQuery");
+  Handle<Object> self = info.Holder();
+  Handle<External> external = Handle<External>::Cast(self->GetInternalField(0));
+  list_T *list = static_cast<list_T*>(external->Value());
+  listitem_T *li = list_find(list, index);
+  if (li == NULL) {
+    info.GetReturnValue().Set(Integer::New(isolate, DontEnum));
+    return;
+  }
+  info.GetReturnValue().Set(Integer::New(isolate, None));
+}
+
+static void
+VimListDelete(uint32_t index, const PropertyCallbackInfo<Boolean>& info)
+{
+  TRACE("VimListDelete");
+  Handle<Object> self = info.Holder();
+  Handle<External> external = Handle<External>::Cast(self->GetInternalField(0));
+  list_T *list = static_cast<list_T*>(external->Value());
+  listitem_T *li = list_find(list, index);
+  if (li == NULL) {
+    info.GetReturnValue().Set(False(isolate));
+    return;
+  }
+  list_remove(list, li, li);
+  listitem_free(li);
+  info.GetReturnValue().Set(True(isolate));
+}
+
+static void
+VimListEnumerate(const PropertyCallbackInfo<Array>& info)
+{
+  TRACE("VimListEnumerate");
+  Handle<Object> self = info.Holder();
+  Handle<External> external = Handle<External>::Cast(self->GetInternalField(0));
+  list_T *list = static_cast<list_T*>(external->Value());
+  uint32_t len = list_len(list);
+  Handle<Array> keys = Array::New(isolate, len);
+  for (uint32_t i = 0; i < len; ++i) {
+    keys->Set(Integer::New(isolate, i), Integer::New(isolate, i));
+  }
+  info.GetReturnValue().Set(keys);
+}
+
+static void
+VimListLength(Local<String> property, const PropertyCallbackInfo<Value>& info)
+{
+  TRACE("VimListLength");
+  Handle<Object> self = info.Holder();
+  Handle<External> external = Handle<External>::Cast(self->GetInternalField(0));
+  list_T *list = static_cast<list_T*>(external->Value());
+  uint32_t len = list_len(list);
+  info.GetReturnValue().Set(Integer::New(isolate, len));
+}
+
+static dict_T *makedictptr = NULL;
+
+// Iterator of VimList.  Like :for, the next item is watched with
+// listwatch_T so that removing items while iterating is safe.  Items are
+// walked by link, not by index.
+struct ListIterator {
+  typval_T tv;          // keeps reference to the list
+  listitem_T *pin;      // item in v_pin
+  listwatch_T lw;       // lw_item is the next item
+  bool watching;
+  Persistent<Value> self;
+};
+
+static void
+ListIteratorFinish(ListIterator *it)
+{
+  if (!it->watching)
+    return;
+  list_rem_watch(it->tv.vval.v_list, &it->lw);
+  UnpinValue(it->pin);
+  clear_tv(&it->tv);
+  it->watching = false;
+}
+
+// vim.List.iterator(list)
+static void
+VimListIterator(const FunctionCallbackInfo<Value>& args)
+{
+  TRACE("VimListIterator");
+  Local<FunctionTemplate> VimList = Local<FunctionTemplate>::New(isolate, p_VimList);
+  if (args.Length() != 1 || !VimList->HasInstance(args[0])) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "usage: vim.List.iterator(VimList list)"));
+    return;
+  }
+  Handle<External> external = Handle<External>::Cast(Handle<Object>::Cast(args[0])->GetInternalField(0));
+  list_T *list = static_cast<list_T*>(external->Value());
+
+  Local<FunctionTemplate> VimListIter = Local<FunctionTemplate>::New(isolate, p_VimListIter);
+  Handle<Object> self = VimListIter->InstanceTemplate()->NewInstance();
+
+  ListIterator *it = new ListIterator;
+  tv_set_list(&it->tv, list);
+  it->pin = PinValue(&it->tv);
+  it->lw.lw_item = list->lv_first;
+  list_add_watch(list, &it->lw);
+  it->watching = true;
+
+  self->SetInternalField(0, External::New(isolate, it));
+  it->self.Reset(isolate, self);
+  it->self.SetWeak(it, VimListIterDestroy);
+
+  args.GetReturnValue().Set(self);
+}
+
+static void
+VimListIterNext(const FunctionCallbackInfo<Value>& args)
+{
+  TRACE("VimListIterNext");
+  Handle<Object> self = args.Holder();
+  Handle<External> external = Handle<External>::Cast(self->GetInternalField(0));
+  ListIterator *it = static_cast<ListIterator*>(external->Value());
+  listitem_T *li = it->watching ? it->lw.lw_item : NULL;
+  Handle<Object> result = Object::New(isolate);
+  if (li == NULL) {
+    ListIteratorFinish(it);
+    result->Set(String::NewFromUtf8(isolate, "value"), Undefined(isolate));
+    result->Set(String::NewFromUtf8(isolate, "done"), True(isolate));
+  } else {
+    it->lw.lw_item = li->li_next;
+    std::string err;
+    Handle<Value> v;
+    if (!vim_to_v8(&li->li_tv, &v, 1, &objcache, &err)) {
+      isolate->ThrowException(String::NewFromUtf8(isolate, err.c_str()));
+      return;
+    }
+    result->Set(String::NewFromUtf8(isolate, "value"), v);
+    result->Set(String::NewFromUtf8(isolate, "done"), False(isolate));
+  }
+  args.GetReturnValue().Set(result);
+}
+
+static void
+VimListIterDestroy(const WeakCallbackData<Value, ListIterator>& data)
+{
+  TRACE("VimListIterDestroy");
+  ListIterator *it = data.GetParameter();
+  ListIteratorFinish(it);
+  it->self.Reset();
+  delete it;
+}
+
+static Handle<Value>
+MakeVimDict(dict_T *dict)
+{
+  TRACE("MakeVimDict");
+
+  Local<FunctionTemplate> VimDict = Local<FunctionTemplate>::New(isolate, p_VimDict);
+
+  makedictptr = dict;
+  Handle<Object> self = VimDict->InstanceTemplate()->NewInstance();
+  makedictptr = NULL;
+
+  return self;
+}
+
+static void
+VimDictCreate(const FunctionCallbackInfo<Value>& args)
+{
+  TRACE("VimDictCreate");
+  if (!args.IsConstructCall()) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "Cannot call constructor as function"));
+    return;
+  }
+
+  Handle<Object> self = args.Holder();
+
+  dict_T *dict;
+  if (makedictptr != NULL) {
+    dict = makedictptr;
+  } else {
+    dict = dict_alloc();
+    if (dict == NULL) {
+      isolate->ThrowException(String::NewFromUtf8(isolate, "VimDictCreate(): dict_alloc(): out of memory"));
+      return;
+    }
+  }
+
+  self->SetInternalField(0, External::New(isolate, dict));
+
+  // increment Vim's reference count
+  typval_T tv;
+  tv_set_dict(&tv, dict);
+  VimRefNew(self, &tv);
+
+  args.GetReturnValue().Set(self);
+}
+
+// Returns the slot of key in the dict of holder.  Empty when not found.
+static hashitem_T *
+VimDictLookup(Handle<Object> holder, DictKey *key, dict_T **pdict)
+{
+  Handle<External> external = Handle<External>::Cast(holder->GetInternalField(0));
+  *pdict = static_cast<dict_T*>(external->Value());
+  return hash_lookup(&(*pdict)->dv_hashtab, key->key, key->hash);
+}
+
+// Returns false when key is not found.
+static bool
+VimDictGetItem(DictKey *key, const PropertyCallbackInfo<Value>& info)
+{
+  Local<FunctionTemplate> VimFunc = Local<FunctionTemplate>::New(isolate, p_VimFunc);
+  dict_T *dict;
+  hashitem_T *hi = VimDictLookup(info.Holder(), key, &dict);
+  if (HASHITEM_EMPTY(hi))
+    return false;
+  std::string err;
+  Handle<Value> v8obj;
+  if (!vim_to_v8(&HI2DI(hi)->di_tv, &v8obj, 1, &objcache, &err)) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, err.c_str()));
+    return true;
+  }
+  // XXX: When obj.func(), args.Holder() and args.This() are VimFunc
+  // insted of obj.  Use internal field for now.
+  if (VimFunc->HasInstance(v8obj)) {
+    Handle<Object> func = Handle<Object>::Cast(v8obj);
+    func->SetInternalField(1, info.Holder());
+  }
+  info.GetReturnValue().Set(v8obj);
+  return true;
+}
+
+static void
+VimDictSetItem(DictKey *key, Local<Value> value, const PropertyCallbackInfo<Value>& info)
+{
+  V8ToVimLookup lookup;
+  std::string err;
   typval_T vimobj;
   if (!v8_to_vim(value, &vimobj, 1, &lookup, &err)) {
     isolate->ThrowException(String::NewFromUtf8(isolate, err.c_str()));
     return;
   }
-  clear_tv(&li->li_tv);
-  li->li_tv = vimobj;
+  // Look up after v8_to_vim().  A getter may change the dict.
+  dict_T *dict;
+  hashitem_T *hi = VimDictLookup(info.Holder(), key, &dict);
+  if (!HASHITEM_EMPTY(hi)) {
+    dictitem_T *di = HI2DI(hi);
+    clear_tv(&di->di_tv);
+    di->di_tv = vimobj;
+  } else {
+    dictitem_T *di = dictitem_alloc(key->key);
+    if (di == NULL || hash_add_item(&dict->dv_hashtab, hi, di->di_key, key->hash) == FAIL) {
+      vim_free(di);
+      clear_tv(&vimobj);
+      isolate->ThrowException(String::NewFromUtf8(isolate, "error dict_set_tv_nocopy()"));
+      return;
+    }
+    di->di_tv = vimobj;
+  }
   info.GetReturnValue().Set(value);
 }
 
 static void
-VimListQuery(uint32_t index, const PropertyCallbackInfo<Integer>& info)
+VimDictQueryItem(DictKey *key, const PropertyCallbackInfo<Integer>& info)
 {
-  TRACE("VimListQuery");
-  Handle<Object> self = info.Holder();
-  Handle<External> external = Handle<External>::Cast(self->GetInternalField(0));
-  list_T *list = static_cast<list_T*>(external->Value());
-  listitem_T *li = list_find(list, index);
-  if (li == NULL) {
+  dict_T *dict;
+  hashitem_T *hi = VimDictLookup(info.Holder(), key, &dict);
+  if (HASHITEM_EMPTY(hi)) {
     info.GetReturnValue().Set(Integer::New(isolate, DontEnum));
     return;
   }
@@ -837,325 +3204,921 @@ VimListQuery(uint32_t index, const PropertyCallbackInfo<Integer>& info)
 }
 
 static void
-VimListDelete(uint32_t index, const PropertyCallbackInfo<Boolean>& info)
+VimDictDeleteItem(DictKey *key, const PropertyCallbackInfo<Boolean>& info)
 {
-  TRACE("VimListDelete");
+  dict_T *dict;
+  hashitem_T *hi = VimDictLookup(info.Holder(), key, &dict);
+  if (HASHITEM_EMPTY(hi)) {
+    info.GetReturnValue().Set(False(isolate));
+    return;
+  }
+  // XXX: save di because hash_remove() clear it.
+  dictitem_T *di = HI2DI(hi);
+  hash_remove(&dict->dv_hashtab, hi);
+  dictitem_free(di);
+  info.GetReturnValue().Set(True(isolate));
+}
+
+static void
+VimDictIdxGet(uint32_t index, const PropertyCallbackInfo<Value>& info)
+{
+  TRACE("VimDictIdxGet");
+  DictKey key;
+  GetDictIndexKey(index, &key);
+  if (!VimDictGetItem(&key, info)) {
+    Handle<Object> prototype = Handle<Object>::Cast(info.Holder()->GetPrototype());
+    info.GetReturnValue().Set(prototype->Get(index));
+  }
+}
+
+static void
+VimDictIdxSet(uint32_t index, Local<Value> value, const PropertyCallbackInfo<Value>& info)
+{
+  TRACE("VimDictIdxSet");
+  DictKey key;
+  GetDictIndexKey(index, &key);
+  VimDictSetItem(&key, value, info);
+}
+
+static void
+VimDictIdxQuery(uint32_t index, const PropertyCallbackInfo<Integer>& info)
+{
+  TRACE("VimDictIdxQuery");
+  DictKey key;
+  GetDictIndexKey(index, &key);
+  VimDictQueryItem(&key, info);
+}
+
+static void
+VimDictIdxDelete(uint32_t index, const PropertyCallbackInfo<Boolean>& info)
+{
+  TRACE("VimDictIdxDelete");
+  DictKey key;
+  GetDictIndexKey(index, &key);
+  VimDictDeleteItem(&key, info);
+}
+
+static void
+VimDictGet(Local<String> property, const PropertyCallbackInfo<Value>& info)
+{
+  TRACE("VimDictGet");
+  DictKey key;
+  if (!GetDictKey(property, &key)) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "Cannot use empty key for Dictionary"));
+    return;
+  }
+  if (!VimDictGetItem(&key, info)) {
+    // fallback to prototype.  otherwise String(obj) don't work due to
+    // lack of toString().
+    Handle<Object> prototype = Handle<Object>::Cast(info.Holder()->GetPrototype());
+    info.GetReturnValue().Set(prototype->Get(property));
+  }
+}
+
+static void
+VimDictSet(Local<String> property, Local<Value> value, const PropertyCallbackInfo<Value>& info)
+{
+  TRACE("VimDictSet");
+  DictKey key;
+  if (!GetDictKey(property, &key)) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "Cannot use empty key for Dictionary"));
+    return;
+  }
+  VimDictSetItem(&key, value, info);
+}
+
+static void
+VimDictQuery(Local<String> property, const PropertyCallbackInfo<Integer>& info)
+{
+  TRACE("VimDictQuery");
+  DictKey key;
+  if (!GetDictKey(property, &key)) {
+    info.GetReturnValue().Set(Integer::New(isolate, DontEnum));
+    return;
+  }
+  VimDictQueryItem(&key, info);
+}
+
+static void
+VimDictDelete(Local<String> property, const PropertyCallbackInfo<Boolean>& info)
+{
+  TRACE("VimDictDelete");
+  DictKey key;
+  if (!GetDictKey(property, &key)) {
+    info.GetReturnValue().Set(False(isolate));
+    return;
+  }
+  VimDictDeleteItem(&key, info);
+}
+
+static void
+VimDictEnumerate(const PropertyCallbackInfo<Array>& info)
+{
+  TRACE("VimDictEnumerate");
   Handle<Object> self = info.Holder();
   Handle<External> external = Handle<External>::Cast(self->GetInternalField(0));
-  list_T *list = static_cast<list_T*>(external->Value());
-  listitem_T *li = list_find(list, index);
-  if (li == NULL) {
-    info.GetReturnValue().Set(False(isolate));
+  dict_T *dict = static_cast<dict_T*>(external->Value());
+  hashtab_T *ht = &dict->dv_hashtab;
+  long_u todo = ht->ht_used;
+  hashitem_T *hi;
+  int i = 0;
+  Handle<Array> keys = Array::New(isolate, todo);
+  for (hi = ht->ht_array; todo > 0; ++hi) {
+    if (!HASHITEM_EMPTY(hi)) {
+      --todo;
+      keys->Set(i++, String::NewFromUtf8(isolate, (char *)hi->hi_key));
+    }
+  }
+  info.GetReturnValue().Set(keys);
+}
+
+static Handle<Value>
+MakeVimFunc(const char *name)
+{
+  TRACE("MakeVimFunc");
+
+  if (name == NULL)
+      return Undefined(isolate);
+
+  Local<FunctionTemplate> VimFunc = Local<FunctionTemplate>::New(isolate, p_VimFunc);
+
+  typval_T tv;
+  tv_set_func(&tv, (char_u*)name);
+
+  Handle<Object> self = VimFunc->InstanceTemplate()->NewInstance();
+  VimRef *ref = VimRefNew(self, &tv);
+  self->SetInternalField(0, External::New(isolate, ref->tv.vval.v_string));
+  self->SetInternalField(1, Undefined(isolate));
+
+  return self;
+}
+
+static void
+VimFuncCall(const FunctionCallbackInfo<Value>& args)
+{
+  TRACE("VimFuncCall");
+  if (args.IsConstructCall()) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "Cannot create VimFunc"));
+    return;
+  }
+
+  Handle<Object> self = args.Holder();
+  Handle<External> external = Handle<External>::Cast(self->GetInternalField(0));
+  char_u *name = static_cast<char_u*>(external->Value());
+
+  if (args.Length() > MAX_FUNC_ARGS) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "VimFuncCall(): too many arguments"));
+    return;
+  }
+
+  Handle<Value> argv[MAX_FUNC_ARGS];
+  for (int i = 0; i < args.Length(); ++i)
+    argv[i] = args[i];
+
+  Handle<Value> result;
+  std::string err;
+  if (!CallVimFunc(name, args.Length(), argv, self->GetInternalField(1), &result, &err)) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, err.c_str()));
+    return;
+  }
+  args.GetReturnValue().Set(result);
+}
+
+// vim.buffer([nr])
+// Without nr or with 0, the current buffer.
+static void
+vim_buffer(const FunctionCallbackInfo<Value>& args)
+{
+  TRACE("vim_buffer");
+  int nr = 0;
+  if (args.Length() > 1 || (args.Length() == 1 && !args[0]->IsInt32())) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "usage: vim.buffer([number nr])"));
+    return;
+  }
+  if (args.Length() == 1)
+    nr = args[0]->Int32Value();
+  if (nr == 0) {
+    char expr[] = "bufnr('%')";
+    typval_T *tv = eval_expr((char_u *)expr, NULL);
+    if (tv == NULL) {
+      isolate->ThrowException(String::NewFromUtf8(isolate, "vim.buffer(): cannot get current buffer"));
+      return;
+    }
+    nr = tv->vval.v_number;
+    free_tv(tv);
+  }
+  if (buflist_findnr(nr) == NULL) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "vim.buffer(): invalid buffer number"));
+    return;
+  }
+  Local<FunctionTemplate> VimBuffer = Local<FunctionTemplate>::New(isolate, p_VimBuffer);
+  Handle<Object> self = VimBuffer->InstanceTemplate()->NewInstance();
+  self->SetInternalField(0, Integer::New(isolate, nr));
+  self->ForceSet(String::NewFromUtf8(isolate, "number"), Integer::New(isolate, nr), ReadOnly);
+  args.GetReturnValue().Set(self);
+}
+
+// The buffer may be wiped out while JavaScript holds VimBuffer, so it is
+// looked up by number every time.
+static buf_T *
+GetVimBuffer(const FunctionCallbackInfo<Value>& args)
+{
+  Handle<Value> nr = args.Holder()->GetInternalField(0);
+  buf_T *buf = nr->IsInt32() ? buflist_findnr(nr->Int32Value()) : NULL;
+  if (buf == NULL)
+    isolate->ThrowException(String::NewFromUtf8(isolate, "VimBuffer: buffer does not exist"));
+  return buf;
+}
+
+// buffer.lineCount()
+static void
+VimBufferLineCount(const FunctionCallbackInfo<Value>& args)
+{
+  TRACE("VimBufferLineCount");
+  buf_T *buf = GetVimBuffer(args);
+  if (buf == NULL)
     return;
-  }
-  list_remove(list, li, li);
-  listitem_free(li);
-  info.GetReturnValue().Set(True(isolate));
+  args.GetReturnValue().Set(Integer::New(isolate, buf->b_ml.ml_line_count));
 }
 
+// buffer.getLines([start [, end]])
+// Lines start..end (1-based, inclusive) as Array.  Default is whole buffer.
 static void
-VimListEnumerate(const PropertyCallbackInfo<Array>& info)
+VimBufferGetLines(const FunctionCallbackInfo<Value>& args)
 {
-  TRACE("VimListEnumerate");
-  Handle<Object> self = info.Holder();
-  Handle<External> external = Handle<External>::Cast(self->GetInternalField(0));
-  list_T *list = static_cast<list_T*>(external->Value());
-  uint32_t len = list_len(list);
-  Handle<Array> keys = Array::New(isolate, len);
-  for (uint32_t i = 0; i < len; ++i) {
-    keys->Set(Integer::New(isolate, i), Integer::New(isolate, i));
+  TRACE("VimBufferGetLines");
+  HandleScope handle_scope(isolate);
+  buf_T *buf = GetVimBuffer(args);
+  if (buf == NULL)
+    return;
+  if (args.Length() > 2 || (args.Length() > 0 && !args[0]->IsNumber()) || (args.Length() > 1 && !args[1]->IsNumber())) {
+    isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "usage: VimBuffer.getLines([number start [, number end]])")));
+    return;
   }
-  info.GetReturnValue().Set(keys);
+  // 64-bit so that end + 1 cannot overflow
+  int64_t count = buf->b_ml.ml_line_count;
+  int64_t start = args.Length() > 0 ? args[0]->IntegerValue() : 1;
+  int64_t end = args.Length() > 1 ? args[1]->IntegerValue() : count;
+  if (start < 1 || end > count || start > end + 1) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "VimBuffer.getLines(): line number out of range"));
+    return;
+  }
+  Handle<Array> lines = Array::New(isolate, (int)(end - start + 1));
+  for (linenr_T lnum = (linenr_T)start; lnum <= (linenr_T)end; ++lnum)
+    lines->Set(lnum - start, MakeV8String(ml_get_buf(buf, lnum, FALSE)));
+  args.GetReturnValue().Set(lines);
 }
 
+// buffer.setLines(start, end, lines)
+// Replace lines start..end (1-based, inclusive) with Array lines.  Use
+// end = start - 1 to insert before start.
 static void
-VimListLength(Local<String> property, const PropertyCallbackInfo<Value>& info)
+VimBufferSetLines(const FunctionCallbackInfo<Value>& args)
 {
-  TRACE("VimListLength");
-  Handle<Object> self = info.Holder();
-  Handle<External> external = Handle<External>::Cast(self->GetInternalField(0));
-  list_T *list = static_cast<list_T*>(external->Value());
-  uint32_t len = list_len(list);
-  info.GetReturnValue().Set(Integer::New(isolate, len));
+  TRACE("VimBufferSetLines");
+  HandleScope handle_scope(isolate);
+  buf_T *buf = GetVimBuffer(args);
+  if (buf == NULL)
+    return;
+  if (args.Length() != 3 || !args[0]->IsNumber() || !args[1]->IsNumber() || !args[2]->IsArray()) {
+    isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "usage: VimBuffer.setLines(number start, number end, Array lines)")));
+    return;
+  }
+  // Checked in 64-bit so that end + 1 cannot overflow.
+  int64_t start = args[0]->IntegerValue();
+  int64_t end = args[1]->IntegerValue();
+  if (start < 1 || end + 1 > (int64_t)buf->b_ml.ml_line_count + 1 || start > end + 1) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "VimBuffer.setLines(): line number out of range"));
+    return;
+  }
+  linenr_T lo = (linenr_T)start;
+  linenr_T hi = (linenr_T)(end + 1);          // exclusive
+
+  // Convert lines before touching the buffer.
+  Handle<Array> arr = Handle<Array>::Cast(args[2]);
+  long new_len = arr->Length();
+  long old_len = hi - lo;
+  std::vector<char_u *> lines(new_len);
+  std::string err;
+  long i;
+  for (i = 0; i < new_len; ++i) {
+    typval_T tv;
+    tv_set_v8string(&tv, arr->Get(i)->ToString());
+    lines[i] = tv.vval.v_string;
+    if (lines[i] == NULL)
+      err = "VimBuffer.setLines(): out of memory";
+    else if (strchr((char *)lines[i], '\n') != NULL)
+      err = "VimBuffer.setLines(): line cannot contain newline";
+    if (!err.empty()) {
+      ++i;
+      break;
+    }
+  }
+  if (!err.empty()) {
+    while (--i >= 0)
+      vim_free(lines[i]);
+    isolate->ThrowException(String::NewFromUtf8(isolate, err.c_str()));
+    return;
+  }
+
+  // Same as if_python's SetBufferLineList().
+  buf_T *savebuf;
+  long extra = 0;
+  switch_buffer(&savebuf, buf);
+  VimTryStart();
+  // 'modifiable' of buf (now curbuf).  buf_T in vimext.h has only b_ml:
+  // the offset of b_p_ma depends on Vim's features, so ask for the option.
+  long modifiable = 0;
+  get_option_value((char_u *)"modifiable", &modifiable, NULL, OPT_LOCAL);
+  i = 0;
+  if (!modifiable)
+    err = "VimBuffer.setLines(): buffer is not modifiable";
+  else if (u_save(lo - 1, hi) == FAIL)
+    err = "VimBuffer.setLines(): cannot save undo information";
+  else {
+    // Delete the excess lines first, then replace in place and append
+    // the rest.  Replacing does not allocate.
+    for (i = 0; i < old_len - new_len; ++i)
+      if (ml_delete(lo, FALSE) == FAIL) {
+        err = "VimBuffer.setLines(): cannot delete line";
+        break;
+      }
+    extra -= i;
+    for (i = 0; err.empty() && i < old_len && i < new_len; ++i) {
+      if (ml_replace(lo + i, lines[i], FALSE) == FAIL) {
+        err = "VimBuffer.setLines(): cannot replace line";
+        break;
+      }
+      lines[i] = NULL;  // owned by memline
+    }
+    for (; err.empty() && i < new_len; ++i) {
+      if (ml_append(lo + i - 1, lines[i], 0, FALSE) == FAIL) {
+        err = "VimBuffer.setLines(): cannot insert line";
+        break;
+      }
+      ++extra;
+    }
+    // Adjust marks.  Invalidate any which lie in the changed range, and
+    // move any in the remainder of the buffer.
+    mark_adjust(lo, hi - 1, (long)MAXLNUM, extra);
+    changed_lines(lo, 0, hi, extra);
+  }
+  std::string vimerr;
+  if (!VimTryEnd(&vimerr) && err.empty())
+    err = vimerr;
+  restore_buffer(savebuf);
+  if (buf == curbuf)
+    check_cursor();
+
+  for (i = 0; i < new_len; ++i)
+    vim_free(lines[i]);
+  if (!err.empty())
+    isolate->ThrowException(String::NewFromUtf8(isolate, err.c_str()));
 }
 
-static dict_T *makedictptr = NULL;
+// Worker
+//
+// vim.Worker(source) runs source in a separate isolate on its own thread.
+// The worker has no access to Vim.  Messages are copied as JSON text
+// through queues; messages from the worker are delivered to onmessage
+// when Vim next calls into if_v8 (execute() or idle()).
+//
+// worker side:  postMessage(value), close(), onmessage = function(e) {}
+// main side:    w.postMessage(value), w.terminate(),
+//               w.onmessage = function(e) {}, w.onerror = function(e) {}
+
+struct WorkerMessage {
+  bool error;         // data is error message, not JSON
+  std::string data;
+};
 
-static Handle<Value>
-MakeVimDict(dict_T *dict)
-{
-  TRACE("MakeVimDict");
+struct WorkerData {
+  std::string source;
+  mutex_T mutex;
+  cond_T cond;
+  std::deque<std::string> inbox;        // main -> worker (JSON)
+  std::deque<WorkerMessage> outbox;     // worker -> main
+  bool closing;
+  bool finished;
+  bool dead;                            // destroyed, freed after delivery
+  Isolate *isolate;                     // worker's isolate while running
+  thread_T thread;
+  Persistent<Object> self;              // main side object
+};
 
-  Local<FunctionTemplate> VimDict = Local<FunctionTemplate>::New(isolate, p_VimDict);
+static std::vector<WorkerData *> workers;
 
-  makedictptr = dict;
-  Handle<Object> self = VimDict->InstanceTemplate()->NewInstance();
-  makedictptr = NULL;
+// A handler called by DeliverWorkerMessages() may terminate any worker.
+// Workers destroyed meanwhile are freed when the outermost delivery ends.
+static int deliver_depth = 0;
+static std::vector<WorkerData *> dead_workers;
 
-  return self;
+// JSON.stringify(value) in the current context of isolate "is".
+static bool
+JsonStringify(Isolate *is, Handle<Value> value, std::string *json)
+{
+  Handle<Object> global = is->GetCurrentContext()->Global();
+  Handle<Object> json_obj = Handle<Object>::Cast(global->Get(String::NewFromUtf8(is, "JSON")));
+  Handle<Function> stringify = Handle<Function>::Cast(json_obj->Get(String::NewFromUtf8(is, "stringify")));
+  Handle<Value> result = stringify->Call(json_obj, 1, &value);
+  if (result.IsEmpty())
+    return false;
+  *json = result->IsUndefined() ? "null" : *String::Utf8Value(result);
+  return true;
 }
 
 static void
-VimDictDestroy(const WeakCallbackData<Value, typval_T>& data)
+WorkerPost(WorkerData *w, bool error, const std::string& data)
 {
-  TRACE("VimDictDestroy");
-  typval_T *tv = data.GetParameter();
+  WorkerMessage msg;
+  msg.error = error;
+  msg.data = data;
+  mutex_lock(&w->mutex);
+  w->outbox.push_back(msg);
+  mutex_unlock(&w->mutex);
+}
 
-  objcache.del(VimValue(tv->vval.v_dict));
+static std::string
+WorkerException(TryCatch *try_catch)
+{
+  String::Utf8Value exception(try_catch->Exception());
+  return *exception ? *exception : "(unknown error)";
+}
 
-  weak_unref(tv);
-  free_tv(tv);
+// postMessage(value) in worker
+static void
+WorkerSelfPostMessage(const FunctionCallbackInfo<Value>& args)
+{
+  WorkerData *w = static_cast<WorkerData *>(Handle<External>::Cast(args.Data())->Value());
+  std::string json;
+  if (JsonStringify(args.GetIsolate(), args[0], &json))
+    WorkerPost(w, false, json);
 }
 
+// close() in worker
 static void
-VimDictCreate(const FunctionCallbackInfo<Value>& args)
+WorkerSelfClose(const FunctionCallbackInfo<Value>& args)
 {
-  TRACE("VimDictCreate");
-  if (!args.IsConstructCall()) {
-    isolate->ThrowException(String::NewFromUtf8(isolate, "Cannot call constructor as function"));
-    return;
-  }
+  WorkerData *w = static_cast<WorkerData *>(Handle<External>::Cast(args.Data())->Value());
+  mutex_lock(&w->mutex);
+  w->closing = true;
+  mutex_unlock(&w->mutex);
+}
 
-  Handle<Object> self = args.Holder();
+static void
+WorkerRun(WorkerData *w, Isolate *wi)
+{
+  Isolate::Scope isolate_scope(wi);
+  HandleScope handle_scope(wi);
+  Handle<External> data = External::New(wi, w);
+  Handle<ObjectTemplate> global = ObjectTemplate::New(wi);
+  global->Set(String::NewFromUtf8(wi, "postMessage"), FunctionTemplate::New(wi, WorkerSelfPostMessage, data));
+  global->Set(String::NewFromUtf8(wi, "close"), FunctionTemplate::New(wi, WorkerSelfClose, data));
+  Local<Context> context = Context::New(wi, NULL, global);
+  Context::Scope context_scope(context);
 
-  dict_T *dict;
-  if (makedictptr != NULL) {
-    dict = makedictptr;
-  } else {
-    dict = dict_alloc();
-    if (dict == NULL) {
-      isolate->ThrowException(String::NewFromUtf8(isolate, "VimDictCreate(): dict_alloc(): out of memory"));
+  {
+    TryCatch try_catch;
+    Handle<Script> script = Script::Compile(String::NewFromUtf8(wi, w->source.c_str()), String::NewFromUtf8(wi, "(worker)"));
+    if (script.IsEmpty() || script->Run().IsEmpty()) {
+      if (!try_catch.HasTerminated())
+        WorkerPost(w, true, WorkerException(&try_catch));
       return;
     }
   }
 
-  self->SetInternalField(0, External::New(isolate, dict));
-
-  // increment Vim's reference count
-  typval_T *tv = alloc_tv();
-  tv_set_dict(tv, dict);
-  weak_ref(tv);
-
-  // make weak reference
-  CopyableValuePersistent p = CopyableValuePersistent();
-  p.Reset(isolate, self);
-  p.SetWeak(tv, VimDictDestroy);
-  objcache.set(VimValue(dict), p);
+  for (;;) {
+    std::string json;
+    mutex_lock(&w->mutex);
+    while (w->inbox.empty() && !w->closing)
+      cond_wait(&w->cond, &w->mutex);
+    bool closing = w->closing;
+    if (!closing) {
+      json = w->inbox.front();
+      w->inbox.pop_front();
+    }
+    mutex_unlock(&w->mutex);
+    if (closing)
+      return;
 
-  args.GetReturnValue().Set(self);
+    HandleScope scope(wi);
+    TryCatch try_catch;
+    Handle<Value> onmessage = context->Global()->Get(String::NewFromUtf8(wi, "onmessage"));
+    if (!onmessage->IsFunction())
+      continue;
+    Handle<Object> event = Object::New(wi);
+    event->Set(String::NewFromUtf8(wi, "data"), JSON::Parse(String::NewFromUtf8(wi, json.c_str())));
+    Handle<Value> argv[1] = {event};
+    if (Handle<Function>::Cast(onmessage)->Call(context->Global(), 1, argv).IsEmpty()) {
+      if (try_catch.HasTerminated())
+        return;
+      WorkerPost(w, true, WorkerException(&try_catch));
+    }
+  }
 }
 
-static void
-VimDictIdxGet(uint32_t index, const PropertyCallbackInfo<Value>& info)
+#ifdef WIN32
+static DWORD WINAPI
+#else
+static void *
+#endif
+WorkerMain(void *arg)
 {
-  TRACE("VimDictIdxGet");
-  VimDictGet(Integer::New(isolate, index)->ToString(), info);
+  WorkerData *w = static_cast<WorkerData *>(arg);
+  Isolate *wi = Isolate::New();
+  mutex_lock(&w->mutex);
+  w->isolate = w->closing ? NULL : wi;
+  mutex_unlock(&w->mutex);
+  if (w->isolate != NULL)
+    WorkerRun(w, wi);
+  // Clear it first so that terminate() does not touch disposed isolate.
+  mutex_lock(&w->mutex);
+  w->isolate = NULL;
+  mutex_unlock(&w->mutex);
+  wi->Dispose();
+  mutex_lock(&w->mutex);
+  w->finished = true;
+  mutex_unlock(&w->mutex);
+  return 0;
 }
 
 static void
-VimDictIdxSet(uint32_t index, Local<Value> value, const PropertyCallbackInfo<Value>& info)
+WorkerFree(WorkerData *w)
 {
-  TRACE("VimDictIdxSet");
-  VimDictSet(Integer::New(isolate, index)->ToString(), value, info);
+  cond_destroy(&w->cond);
+  mutex_destroy(&w->mutex);
+  delete w;
 }
 
+// Stop the thread and free the worker.  The JavaScript object is left
+// with an empty internal field.
 static void
-VimDictIdxQuery(uint32_t index, const PropertyCallbackInfo<Integer>& info)
+WorkerDestroy(WorkerData *w)
 {
-  TRACE("VimDictIdxQuery");
-  VimDictQuery(Integer::New(isolate, index)->ToString(), info);
+  mutex_lock(&w->mutex);
+  w->closing = true;
+  if (w->isolate != NULL)
+    w->isolate->TerminateExecution();
+  cond_signal(&w->cond);
+  mutex_unlock(&w->mutex);
+#ifdef WIN32
+  WaitForSingleObject(w->thread, INFINITE);
+  CloseHandle(w->thread);
+#else
+  pthread_join(w->thread, NULL);
+#endif
+  Local<Object>::New(isolate, w->self)->SetInternalField(0, Null(isolate));
+  w->self.Reset();
+  workers.erase(std::find(workers.begin(), workers.end(), w));
+  w->dead = true;
+  if (deliver_depth > 0)
+    dead_workers.push_back(w);
+  else
+    WorkerFree(w);
 }
 
-static void
-VimDictIdxDelete(uint32_t index, const PropertyCallbackInfo<Boolean>& info)
+static WorkerData *
+GetWorker(const FunctionCallbackInfo<Value>& args)
 {
-  TRACE("VimDictIdxDelete");
-  VimDictDelete(Integer::New(isolate, index)->ToString(), info);
+  Handle<Value> v = args.Holder()->GetInternalField(0);
+  if (!v->IsExternal()) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "Worker: terminated"));
+    return NULL;
+  }
+  return static_cast<WorkerData *>(Handle<External>::Cast(v)->Value());
 }
 
+// new vim.Worker(source)
 static void
-VimDictGet(Local<String> property, const PropertyCallbackInfo<Value>& info)
+WorkerCreate(const FunctionCallbackInfo<Value>& args)
 {
-  TRACE("VimDictIdxGet");
-  Local<FunctionTemplate> VimFunc = Local<FunctionTemplate>::New(isolate, p_VimFunc);
-  if (property->Length() == 0) {
-    isolate->ThrowException(String::NewFromUtf8(isolate, "Cannot use empty key for Dictionary"));
+  TRACE("WorkerCreate");
+  if (!args.IsConstructCall()) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "Cannot call constructor as function"));
     return;
   }
-  Handle<Object> self = info.Holder();
-  Handle<External> external = Handle<External>::Cast(self->GetInternalField(0));
-  dict_T *dict = static_cast<dict_T*>(external->Value());
-  String::Utf8Value key(property);
-  dictitem_T *di = dict_find(dict, (char_u*)*key, -1);
-  if (di == NULL) {
-    // fallback to prototype.  otherwise String(obj) don't work due to
-    // lack of toString().
-    Handle<Object> prototype = Handle<Object>::Cast(self->GetPrototype());
-    info.GetReturnValue().Set(prototype->Get(property));
+  if (args.Length() != 1 || !args[0]->IsString()) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "usage: new vim.Worker(string source)"));
     return;
   }
-  std::string err;
-  Handle<Value> v8obj;
-  if (!vim_to_v8(&di->di_tv, &v8obj, 1, &objcache, &err)) {
-    isolate->ThrowException(String::NewFromUtf8(isolate, err.c_str()));
+
+  WorkerData *w = new WorkerData;
+  w->source = *String::Utf8Value(args[0]);
+  w->closing = false;
+  w->finished = false;
+  w->dead = false;
+  w->isolate = NULL;
+  mutex_init(&w->mutex);
+  cond_init(&w->cond);
+#ifdef WIN32
+  w->thread = CreateThread(NULL, 0, WorkerMain, w, 0, NULL);
+  bool ok = (w->thread != NULL);
+#else
+  bool ok = (pthread_create(&w->thread, NULL, WorkerMain, w) == 0);
+#endif
+  if (!ok) {
+    cond_destroy(&w->cond);
+    mutex_destroy(&w->mutex);
+    delete w;
+    isolate->ThrowException(String::NewFromUtf8(isolate, "vim.Worker(): cannot create thread"));
     return;
   }
-  // XXX: When obj.func(), args.Holder() and args.This() are VimFunc
-  // insted of obj.  Use internal field for now.
-  if (VimFunc->HasInstance(v8obj)) {
-    Handle<Object> func = Handle<Object>::Cast(v8obj);
-    func->SetInternalField(1, self);
-  }
-  info.GetReturnValue().Set(v8obj);
+
+  Handle<Object> self = args.Holder();
+  self->SetInternalField(0, External::New(isolate, w));
+  // Strong reference: onmessage must be called even if the script does
+  // not keep the worker.
+  w->self.Reset(isolate, self);
+  workers.push_back(w);
+  args.GetReturnValue().Set(self);
 }
 
+// worker.postMessage(value)
 static void
-VimDictSet(Local<String> property, Local<Value> value, const PropertyCallbackInfo<Value>& info)
+WorkerPostMessage(const FunctionCallbackInfo<Value>& args)
 {
-  TRACE("VimDictSet");
-  if (property->Length() == 0) {
-    isolate->ThrowException(String::NewFromUtf8(isolate, "Cannot use empty key for Dictionary"));
+  TRACE("WorkerPostMessage");
+  WorkerData *w = GetWorker(args);
+  if (w == NULL)
     return;
-  }
-  Handle<Object> self = info.Holder();
-  Handle<External> external = Handle<External>::Cast(self->GetInternalField(0));
-  dict_T *dict = static_cast<dict_T*>(external->Value());
-  String::Utf8Value key(property);
-  V8ToVimLookup lookup;
-  std::string err;
-  typval_T vimobj;
-  if (!v8_to_vim(value, &vimobj, 1, &lookup, &err)) {
-    isolate->ThrowException(String::NewFromUtf8(isolate, err.c_str()));
-    return;
-  }
-  if (!dict_set_tv_nocopy(dict, (char_u*)*key, &vimobj)) {
-    clear_tv(&vimobj);
-    isolate->ThrowException(String::NewFromUtf8(isolate, "error dict_set_tv_nocopy()"));
+  std::string json;
+  if (!JsonStringify(isolate, args[0], &json))
     return;
-  }
-  info.GetReturnValue().Set(value);
+  mutex_lock(&w->mutex);
+  w->inbox.push_back(json);
+  cond_signal(&w->cond);
+  mutex_unlock(&w->mutex);
 }
 
+// worker.terminate()
 static void
-VimDictQuery(Local<String> property, const PropertyCallbackInfo<Integer>& info)
+WorkerTerminate(const FunctionCallbackInfo<Value>& args)
 {
-  TRACE("VimDictQuery");
-  Handle<Object> self = info.Holder();
-  Handle<External> external = Handle<External>::Cast(self->GetInternalField(0));
-  dict_T *dict = static_cast<dict_T*>(external->Value());
-  String::Utf8Value key(property);
-  dictitem_T *di = dict_find(dict, (char_u*)*key, -1);
-  if (di == NULL) {
-    info.GetReturnValue().Set(Integer::New(isolate, DontEnum));
+  TRACE("WorkerTerminate");
+  WorkerData *w = GetWorker(args);
+  if (w == NULL)
     return;
-  }
-  info.GetReturnValue().Set(Integer::New(isolate, None));
+  WorkerDestroy(w);
 }
 
+// Call onmessage/onerror for messages from workers, and clean up workers
+// that called close() or failed.  Called with the main context entered.
 static void
-VimDictDelete(Local<String> property, const PropertyCallbackInfo<Boolean>& info)
+DeliverWorkerMessages()
 {
-  TRACE("VimDictDelete");
-  if (property->Length() == 0) {
-    info.GetReturnValue().Set(False(isolate));
+  if (workers.empty())
     return;
+  TRACE("DeliverWorkerMessages");
+  HandleScope handle_scope(isolate);
+  std::vector<WorkerData *> ws = workers;
+  ++deliver_depth;
+  for (size_t i = 0; i < ws.size(); ++i) {
+    WorkerData *w = ws[i];
+    if (w->dead)
+      continue;
+    std::deque<WorkerMessage> outbox;
+    mutex_lock(&w->mutex);
+    outbox.swap(w->outbox);
+    bool finished = w->finished;
+    mutex_unlock(&w->mutex);
+
+    Handle<Object> self = Local<Object>::New(isolate, w->self);
+    for (size_t j = 0; j < outbox.size(); ++j) {
+      TryCatch try_catch;
+      Handle<Value> handler = self->Get(String::NewFromUtf8(isolate, outbox[j].error ? "onerror" : "onmessage"));
+      Handle<Object> event = Object::New(isolate);
+      if (outbox[j].error)
+        event->Set(String::NewFromUtf8(isolate, "message"), String::NewFromUtf8(isolate, outbox[j].data.c_str()));
+      else
+        event->Set(String::NewFromUtf8(isolate, "data"), JSON::Parse(String::NewFromUtf8(isolate, outbox[j].data.c_str())));
+      if (handler->IsFunction()) {
+        Handle<Value> argv[1] = {event};
+        if (Handle<Function>::Cast(handler)->Call(self, 1, argv).IsEmpty()) {
+          if (try_catch.HasTerminated()) {
+            // timed out or interrupted: keep the rest for the next time
+            if (!w->dead) {
+              mutex_lock(&w->mutex);
+              w->outbox.insert(w->outbox.begin(), outbox.begin() + j + 1, outbox.end());
+              mutex_unlock(&w->mutex);
+            }
+            finished = false;
+            i = ws.size();
+            break;
+          }
+          emsg((char_u *)WorkerException(&try_catch).c_str());
+        }
+      } else if (outbox[j].error) {
+        std::string err = "vim.Worker: " + outbox[j].data;
+        emsg((char_u *)err.c_str());
+      }
+      // the handler may terminate the worker
+      if (w->dead)
+        break;
+    }
+    if (finished && !w->dead)
+      WorkerDestroy(w);
   }
-  Handle<Object> self = info.Holder();
-  Handle<External> external = Handle<External>::Cast(self->GetInternalField(0));
-  dict_T *dict = static_cast<dict_T*>(external->Value());
-  String::Utf8Value key(property);
-  dictitem_T *di = dict_find(dict, (char_u*)*key, -1);
-  if (di == NULL) {
-    info.GetReturnValue().Set(False(isolate));
-    return;
+  if (--deliver_depth == 0) {
+    for (size_t i = 0; i < dead_workers.size(); ++i)
+      WorkerFree(dead_workers[i]);
+    dead_workers.clear();
   }
-  dictitem_remove(dict, di);
-  info.GetReturnValue().Set(True(isolate));
 }
 
-static void
-VimDictEnumerate(const PropertyCallbackInfo<Array>& info)
+// vim.profiler
+//
+// start(name), stop(name, path): CPU profile in .cpuprofile JSON.
+// heapSnapshot(path): heap snapshot in .heapsnapshot JSON.
+// startHeapTracking(), stopHeapTracking(path): heap snapshot with
+//   allocation traces recorded since startHeapTracking().
+// callbackStats(), resetCallbackStats(): wall time of native callbacks
+//   when compiled with PROFILE_CALLBACKS.
+
+static std::string
+JsonQuote(const char *s)
 {
-  TRACE("VimDictEnumerate");
-  Handle<Object> self = info.Holder();
-  Handle<External> external = Handle<External>::Cast(self->GetInternalField(0));
-  dict_T *dict = static_cast<dict_T*>(external->Value());
-  hashtab_T *ht = &dict->dv_hashtab;
-  long_u todo = ht->ht_used;
-  hashitem_T *hi;
-  int i = 0;
-  Handle<Array> keys = Array::New(isolate, todo);
-  for (hi = ht->ht_array; todo > 0; ++hi) {
-    if (!HASHITEM_EMPTY(hi)) {
-      --todo;
-      keys->Set(Integer::New(isolate, i++), String::NewFromUtf8(isolate, (char *)hi->hi_key));
-    }
+  std::string r = "\"";
+  for (; *s != '\0'; ++s) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\') {
+      r += '\\';
+      r += c;
+    } else if (c < 0x20) {
+      char buf[8];
+      sprintf(buf, "\\u%04x", c);
+      r += buf;
+    } else
+      r += c;
   }
-  info.GetReturnValue().Set(keys);
+  return r + "\"";
 }
 
-static Handle<Value>
-MakeVimFunc(const char *name)
+static bool
+WriteStringToFile(const char *path, const std::string& data)
 {
-  TRACE("MakeVimFunc");
+  FILE *file = fopen(path, "wb");
+  if (file == NULL)
+    return false;
+  bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+  if (fclose(file) != 0)
+    ok = false;
+  return ok;
+}
 
-  if (name == NULL)
-      return Undefined(isolate);
+static void
+WriteProfileNode(std::ostringstream& out, const CpuProfileNode *node)
+{
+  out << "{\"functionName\":" << JsonQuote(*String::Utf8Value(node->GetFunctionName()))
+    << ",\"scriptId\":" << node->GetScriptId()
+    << ",\"url\":" << JsonQuote(*String::Utf8Value(node->GetScriptResourceName()))
+    << ",\"lineNumber\":" << node->GetLineNumber()
+    << ",\"columnNumber\":" << node->GetColumnNumber()
+    << ",\"hitCount\":" << node->GetHitCount()
+    << ",\"callUID\":" << node->GetCallUid()
+    << ",\"bailoutReason\":" << JsonQuote(node->GetBailoutReason())
+    << ",\"id\":" << node->GetNodeId()
+    << ",\"children\":[";
+  for (int i = 0; i < node->GetChildrenCount(); ++i) {
+    if (i != 0)
+      out << ",";
+    WriteProfileNode(out, node->GetChild(i));
+  }
+  out << "]}";
+}
 
-  Local<FunctionTemplate> VimFunc = Local<FunctionTemplate>::New(isolate, p_VimFunc);
+// vim.profiler.start(name)
+static void
+ProfilerStart(const FunctionCallbackInfo<Value>& args)
+{
+  if (args.Length() != 1 || !args[0]->IsString()) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "usage: vim.profiler.start(string name)"));
+    return;
+  }
+  isolate->GetCpuProfiler()->StartProfiling(args[0]->ToString(), true);
+}
 
-  typval_T *tv = alloc_tv();
-  tv_set_func(tv, (char_u*)name);
-  weak_ref(tv);
+// vim.profiler.stop(name, path)
+static void
+ProfilerStop(const FunctionCallbackInfo<Value>& args)
+{
+  if (args.Length() != 2 || !args[0]->IsString() || !args[1]->IsString()) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "usage: vim.profiler.stop(string name, string path)"));
+    return;
+  }
+  CpuProfile *profile = isolate->GetCpuProfiler()->StopProfiling(args[0]->ToString());
+  if (profile == NULL) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "vim.profiler.stop(): profile is not started"));
+    return;
+  }
+  std::ostringstream out;
+  out << "{\"head\":";
+  WriteProfileNode(out, profile->GetTopDownRoot());
+  // Old .cpuprofile format: startTime/endTime in seconds, timestamps in
+  // usec.
+  out << ",\"startTime\":" << profile->GetStartTime() / 1000000.0
+    << ",\"endTime\":" << profile->GetEndTime() / 1000000.0
+    << ",\"samples\":[";
+  for (int i = 0; i < profile->GetSamplesCount(); ++i)
+    out << (i == 0 ? "" : ",") << profile->GetSample(i)->GetNodeId();
+  out << "],\"timestamps\":[";
+  for (int i = 0; i < profile->GetSamplesCount(); ++i)
+    out << (i == 0 ? "" : ",") << profile->GetSampleTimestamp(i);
+  out << "]}";
+  profile->Delete();
+  if (!WriteStringToFile(*String::Utf8Value(args[1]), out.str()))
+    isolate->ThrowException(String::NewFromUtf8(isolate, "vim.profiler.stop(): cannot write file"));
+}
 
-  Handle<Object> self = VimFunc->InstanceTemplate()->NewInstance();
-  self->SetInternalField(0, External::New(isolate, tv->vval.v_string));
-  self->SetInternalField(1, Undefined(isolate));
+class FileOutputStream : public OutputStream {
+public:
+  FileOutputStream(FILE *file) : _file(file), _ok(true) {}
+  void EndOfStream() {}
+  WriteResult WriteAsciiChunk(char *data, int size) {
+    if (fwrite(data, 1, size, _file) != (size_t)size)
+      _ok = false;
+    return _ok ? kContinue : kAbort;
+  }
+  bool ok() const { return _ok; }
 
-  // make weak reference
-  CopyableValuePersistent p = CopyableValuePersistent();
-  p.Reset(isolate, self);
-  p.SetWeak(tv, VimFuncDestroy);
-  objcache.set(VimValue(tv->vval.v_string), p);
+private:
+  FILE *_file;
+  bool _ok;
+};
 
-  return self;
+static bool
+WriteHeapSnapshot(const char *path)
+{
+  FILE *file = fopen(path, "wb");
+  if (file == NULL)
+    return false;
+  const HeapSnapshot *snapshot = isolate->GetHeapProfiler()->TakeHeapSnapshot(String::NewFromUtf8(isolate, "if_v8"));
+  FileOutputStream stream(file);
+  snapshot->Serialize(&stream, HeapSnapshot::kJSON);
+  const_cast<HeapSnapshot *>(snapshot)->Delete();
+  bool ok = stream.ok();
+  if (fclose(file) != 0)
+    ok = false;
+  return ok;
 }
 
+// vim.profiler.heapSnapshot(path)
 static void
-VimFuncDestroy(const WeakCallbackData<Value, typval_T>& data)
+ProfilerHeapSnapshot(const FunctionCallbackInfo<Value>& args)
 {
-  TRACE("VimFuncDestroy");
-  typval_T *tv = data.GetParameter();
-
-  objcache.del(VimValue(tv->vval.v_string));
+  if (args.Length() != 1 || !args[0]->IsString()) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "usage: vim.profiler.heapSnapshot(string path)"));
+    return;
+  }
+  if (!WriteHeapSnapshot(*String::Utf8Value(args[0])))
+    isolate->ThrowException(String::NewFromUtf8(isolate, "vim.profiler.heapSnapshot(): cannot write file"));
+}
 
-  weak_unref(tv);
-  free_tv(tv);
+// vim.profiler.startHeapTracking()
+// This V8 has no sampling heap profiler; allocation tracking records the
+// stack of every allocation and is written with the next snapshot.
+static void
+ProfilerStartHeapTracking(const FunctionCallbackInfo<Value>& args)
+{
+  isolate->GetHeapProfiler()->StartTrackingHeapObjects(true);
 }
 
+// vim.profiler.stopHeapTracking(path)
 static void
-VimFuncCall(const FunctionCallbackInfo<Value>& args)
+ProfilerStopHeapTracking(const FunctionCallbackInfo<Value>& args)
 {
-  TRACE("VimFuncCall");
-  if (args.IsConstructCall()) {
-    isolate->ThrowException(String::NewFromUtf8(isolate, "Cannot create VimFunc"));
+  if (args.Length() != 1 || !args[0]->IsString()) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "usage: vim.profiler.stopHeapTracking(string path)"));
     return;
   }
+  bool ok = WriteHeapSnapshot(*String::Utf8Value(args[0]));
+  isolate->GetHeapProfiler()->StopTrackingHeapObjects();
+  if (!ok)
+    isolate->ThrowException(String::NewFromUtf8(isolate, "vim.profiler.stopHeapTracking(): cannot write file"));
+}
 
-  Handle<Object> self = args.Holder();
-
-  Handle<Array> arr = Array::New(isolate, args.Length());
-  for (int i = 0; i < args.Length(); ++i)
-    arr->Set(Integer::New(isolate, i), args[i]);
-
-  Handle<Value> obj = self->GetInternalField(1);
-
-  Handle<Value> callargs[3] = {self, arr, obj};
-
-  // return vim.call(name, args, obj)
-  Local<Context> context = Local<Context>::New(isolate, p_context);
-  Handle<Object> vim = Handle<Object>::Cast(context->Global()->Get(String::NewFromUtf8(isolate, "vim")));
-  Handle<Function> call = Handle<Function>::Cast(vim->Get(String::NewFromUtf8(isolate, "call")));
-  args.GetReturnValue().Set(call->Call(vim, 3, callargs));
+// vim.profiler.callbackStats()
+// {name: {count: n, total: usec, histogram: [n of < 1usec, < 2usec, < 4usec, ...]}}
+static void
+ProfilerCallbackStats(const FunctionCallbackInfo<Value>& args)
+{
+  Handle<Object> result = Object::New(isolate);
+  for (CallbackStat *stat = CallbackStat::head; stat != NULL; stat = stat->next) {
+    Handle<Object> o = Object::New(isolate);
+    o->Set(String::NewFromUtf8(isolate, "count"), Number::New(isolate, (double)stat->count));
+    o->Set(String::NewFromUtf8(isolate, "total"), Number::New(isolate, stat->total));
+    Handle<Array> hist = Array::New(isolate, CallbackStat::NBUCKETS);
+    for (int i = 0; i < CallbackStat::NBUCKETS; ++i)
+      hist->Set(i, Number::New(isolate, (double)stat->buckets[i]));
+    o->Set(String::NewFromUtf8(isolate, "histogram"), hist);
+    result->Set(String::NewFromUtf8(isolate, stat->name), o);
+  }
+  args.GetReturnValue().Set(result);
 }
 
+// vim.profiler.resetCallbackStats()
+static void
+ProfilerResetCallbackStats(const FunctionCallbackInfo<Value>& args)
+{
+  for (CallbackStat *stat = CallbackStat::head; stat != NULL; stat = stat->next)
+    stat->reset();
+}
@@ -5,7 +5,8 @@ command! -nargs=* V8 execute V8(<q-args>, expand('<sfile>') == '')
 
 augroup V8
   au!
-  autocmd CursorHold,CursorHoldI * execute s:lib.v8execute("gc()")
+  autocmd CursorHold,CursorHoldI * call s:lib.idle()
+  autocmd VimLeavePre * call s:lib.uninit()
 augroup END
 
 function! V8End()
@@ -39,12 +40,18 @@ let s:lib.runtime = [
       \ s:lib.dir . '/runtime.js',
       \ ]
 let s:lib.flags = '--expose-gc'
+" code cache of load()ed files.  set g:if_v8_cachedir to '' to disable.
+let s:lib.cachedir = get(g:, 'if_v8_cachedir', expand('~/.cache/if_v8'))
 
 function s:lib.init() abort
   if exists('s:init')
     return
   endif
   let s:init = 1
+  if self.cachedir != '' && !isdirectory(self.cachedir) && exists('*mkdir')
+    call mkdir(self.cachedir, 'p')
+  endif
+  let g:__if_v8['%v8_cachedir%'] = isdirectory(self.cachedir) ? self.cachedir : ''
   if has('win32')
     " If if_v8.dll links to separated v8.dll, we need to set $PATH.
     let path_save = $PATH
@@ -57,9 +64,17 @@ function s:lib.init() abort
   if err != ''
     echoerr err
   endif
-  for file in self.runtime
-    call libcall(self.dll, 'execute', printf("load(\"%s\")", escape(file, '\"')))
-  endfor
+  " load all files with one call
+  let files = map(copy(self.runtime), 'printf("\"%s\"", escape(v:val, ''\"''))')
+  call libcall(self.dll, 'execute', printf("load(%s)", join(files, ', ')))
+endfunction
+
+function s:lib.idle()
+  call libcall(self.dll, 'idle', string(&updatetime))
+endfunction
+
+function s:lib.uninit()
+  call libcall(self.dll, 'uninit', '')
 endfunction
 
 function s:lib.v8start()
@@ -65,6 +65,9 @@ function s:test.test5()
   V8 print(vim.eval("x"))
   V8 vim.let("x", 2)
   echo x
+  execute s:Test("test5", "x == 2")
+  V8 vim.let("l:x", "3")
+  execute s:Test("test5", "x ==# '3'")
   let x = eval(V8Eval('1 + 2'))
   echo x
 endfunction
@@ -206,6 +209,118 @@ function s:test.test14()
   execute s:Test("test14", "ok")
 endfunction
 
+" test15: Worker
+function s:test.test15()
+  unlet! g:test15_result
+  V8Start
+  V8 var w = new vim.Worker("onmessage = function(e) { postMessage(e.data * 2); close(); }");
+  V8 w.onmessage = function(e) { vim.g.test15_result = e.data; };
+  V8 w.postMessage(21);
+  execute V8End()
+  " messages are delivered when Vim calls into if_v8
+  for i in range(500)
+    V8 0
+    if exists('g:test15_result')
+      break
+    endif
+    sleep 10m
+  endfor
+  V8Start
+  V8 eval(Test("test15", "vim.g.test15_result === 42"))
+  execute V8End()
+endfunction
+
+" test16: require
+function s:test.test16()
+  let dir = tempname()
+  call mkdir(dir . '/js', 'p')
+  call writefile(['exports.count = (exports.count || 0) + 1;', 'exports.sub = require("./sub");'], dir . '/js/test16.js')
+  call writefile(['module.exports = 42;'], dir . '/js/sub.js')
+  let rtp_save = &runtimepath
+  let &runtimepath .= ',' . dir
+  V8Start
+  V8 var a = require('test16');
+  V8 var b = require('test16');
+  V8 eval(Test("test16", "a === b && a.count === 1 && a.sub === 42"))
+  execute V8End()
+  let &runtimepath = rtp_save
+endfunction
+
+" test17: vim.json
+function s:test.test17()
+  let g:test17 = {'a': [1, 2.5, 'x"y'], 'b': {'c': 'é'}}
+  V8Start
+  V8 var text = vim.json.encode(vim.g.test17);
+  V8 var d = vim.json.decode(text);
+  V8 eval(Test("test17", "d.a[2] === 'x\"y' && d.b.c === 'é' && vim.json.encode(d) === text"))
+  V8 var ok = false;
+  V8 try { vim.json.decode('[1,'); } catch (e) { ok = true; }
+  V8 eval(Test("test17", "ok"))
+  execute V8End()
+  unlet g:test17
+endfunction
+
+" test18: VimBuffer
+function s:test.test18()
+  new
+  call setline(1, ['a', 'b', 'c', 'd'])
+  V8Start
+  V8 var b = vim.buffer();
+  V8 var error = function(f) { try { f(); return null; } catch (e) { return e; } };
+  V8 eval(Test("test18", "b.lineCount() === 4 && b.getLines().join() === 'a,b,c,d'"))
+  V8 eval(Test("test18", "b.getLines(2, 3).join() === 'b,c' && b.getLines(3, 2).length === 0"))
+  V8 eval(Test("test18", "error(function() { b.getLines(0, 1); }) !== null && error(function() { b.getLines(1, 5); }) !== null"))
+  V8 eval(Test("test18", "error(function() { b.getLines('1'); }) instanceof TypeError"))
+  V8 eval(Test("test18", "error(function() { b.setLines('1', 1, []); }) instanceof TypeError"))
+  V8 eval(Test("test18", "error(function() { b.setLines(1, 2147483647, []); }) !== null"))
+  V8 eval(Test("test18", "error(function() { b.setLines(3, 1, []); }) !== null"))
+  V8 b.setLines(2, 3, ['B']);
+  V8 eval(Test("test18", "b.getLines().join() === 'a,B,d'"))
+  V8 b.setLines(1, 1, ['x', 'y']);
+  V8 eval(Test("test18", "b.getLines().join() === 'x,y,B,d'"))
+  V8 b.setLines(1, 0, ['top']);
+  V8 b.setLines(6, 5, ['end']);
+  V8 eval(Test("test18", "b.getLines().join() === 'top,x,y,B,d,end'"))
+  V8 b.setLines(2, 3, []);
+  V8 eval(Test("test18", "b.getLines().join() === 'top,B,d,end'"))
+  V8 var sizes = [];
+  V8 var it = b.chunks(3);
+  V8 for (var r = it.next(); !r.done; r = it.next()) { sizes.push(r.value.length); }
+  V8 eval(Test("test18", "sizes.join() === '3,1' && b.chunks(3, 5).next().done"))
+  execute V8End()
+  execute s:Test("test18", "getline(1, '$') == ['top', 'B', 'd', 'end']")
+  setlocal nomodifiable
+  V8Start
+  V8 eval(Test("test18", "error(function() { b.setLines(1, 1, ['z']); }) !== null"))
+  execute V8End()
+  bwipe!
+endfunction
+
+" test19: typed arrays
+function s:test.test19()
+  let g:test19 = [1, -1, 0x7fffffff]
+  V8Start
+  V8 var i32 = vim.ListToArray(vim.g.test19, 'Int32Array');
+  V8 var u32 = vim.ListToArray(vim.g.test19, 'Uint32Array');
+  V8 var f64 = vim.ListToArray(vim.g.test19, 'Float64Array');
+  V8 eval(Test("test19", "i32 instanceof Int32Array && i32.length === 3 && i32[1] === -1 && i32[2] === 2147483647"))
+  V8 eval(Test("test19", "u32 instanceof Uint32Array && u32[1] === 4294967295"))
+  V8 eval(Test("test19", "f64 instanceof Float64Array && f64[1] === -1"))
+  V8 eval(Test("test19", "vim.ListToArray(new vim.List(), 'Int32Array').length === 0"))
+  V8 var ok = false;
+  V8 try { vim.ListToArray(vim.ArrayToList(['x']), 'Int32Array'); } catch (e) { ok = true; }
+  V8 eval(Test("test19", "ok"))
+  V8 vim.g.test19_i32 = vim.ArrayToList(i32);
+  V8 vim.g.test19_u32 = vim.ArrayToList(u32);
+  execute V8End()
+  execute s:Test("test19", "g:test19_i32 == [1, -1, 0x7fffffff]")
+  " Number is 64-bit
+  if 0x7fffffff + 1 > 0
+    execute s:Test("test19", "g:test19_u32 == [1, 4294967295, 0x7fffffff]")
+  endif
+  unlet g:test19 g:test19_i32 g:test19_u32
+endfunction
+
 function! s:mysort(a, b)
   let a = matchstr(a:a, '\d\+')
   let b = matchstr(a:b, '\d\+')
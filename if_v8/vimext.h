@@ -21,6 +21,9 @@
 #define FALSE 0
 #define TRUE 1
 
+#define OK 1
+#define FAIL 0
+
 #define STRLEN(s)	    strlen((char *)(s))
 #define STRCPY(d, s)	    strcpy((char *)(d), (char *)(s))
 
@@ -223,6 +226,55 @@ static dictitem_T dumdi;
 
 struct condstack;
 
+typedef long	linenr_T;	/* line number type */
+typedef int	colnr_T;	/* column number type */
+
+#define MAXLNUM (0x7fffffffL)	/* maximum (invalid) line number */
+
+/*
+ * Buffer.
+ * XXX: only the line count at the head of it is used.
+ */
+typedef struct memline
+{
+    linenr_T	ml_line_count;	/* number of lines in the buffer */
+} memline_T;
+
+typedef struct file_buffer
+{
+    memline_T	b_ml;		/* associated memline (also contains line count) */
+} buf_T;
+
+#define OPT_LOCAL	4	/* get_option_value(): only local value */
+
+/* Maximum number of function arguments */
+#define MAX_FUNC_ARGS	20
+
+/*
+ * A list of error messages that can be converted to an exception.
+ */
+struct msglist
+{
+    char_u		*msg;		/* original message */
+    char_u		*throw_msg;	/* msg to throw: usually original one */
+    struct msglist	*next;		/* next of several messages in a row */
+};
+
+/*
+ * Structure describing an exception.
+ * XXX: only the leading members are used.
+ */
+typedef struct vim_exception except_T;
+struct vim_exception
+{
+    int			type;		/* exception type */
+    char_u		*value;		/* exception value */
+    struct msglist	*messages;	/* message(s) causing error exception */
+    char_u		*throw_name;	/* name of the throw point */
+    long		throw_lnum;	/* line number of the throw point */
+    except_T		*caught;	/* next exception on the caught stack */
+};
+
 /* functions {{{1 */
 static const char *init_vim();
 /* typval */
@@ -232,6 +284,8 @@ static listitem_T *listitem_alloc();
 static void listitem_free(listitem_T *item);
 static listitem_T *list_find(list_T *l, long n);
 static void list_append(list_T *l, listitem_T *item);
+static void list_add_watch(list_T *l, listwatch_T *lw);
+static void list_rem_watch(list_T *l, listwatch_T *lwrem);
 static void list_fix_watch(list_T *l, listitem_T *item);
 static void list_remove(list_T *l, listitem_T *item, listitem_T *item2);
 static long list_len(list_T *l);
@@ -266,6 +320,12 @@ extern "C" {
 /* variables */
 DLLIMPORT char_u hash_removed;
 DLLIMPORT int got_int;
+DLLIMPORT int did_emsg;
+DLLIMPORT int did_throw;
+DLLIMPORT int trylevel;
+DLLIMPORT except_T *current_exception;
+DLLIMPORT struct msglist **msg_list;
+DLLIMPORT buf_T *curbuf;
 /* functions */
 DLLIMPORT typval_T *eval_expr(char_u *arg, char_u **nextcmd);
 DLLIMPORT int do_cmdline_cmd(char_u *cmd);
@@ -280,12 +340,32 @@ DLLIMPORT char_u *vim_strnsave(char_u *string, int len);
 DLLIMPORT void vim_strncpy(char_u *to, char_u *from, size_t len);
 DLLIMPORT list_T *list_alloc();
 DLLIMPORT void list_free(list_T *l, int recurse);
+DLLIMPORT void list_unref(list_T *l);
 DLLIMPORT dict_T *dict_alloc();
 DLLIMPORT int hash_add(hashtab_T *ht, char_u *key);
 DLLIMPORT hashitem_T *hash_find(hashtab_T *ht, char_u *key);
 DLLIMPORT void hash_remove(hashtab_T *ht, hashitem_T *hi);
+DLLIMPORT hashitem_T *hash_lookup(hashtab_T *ht, char_u *key, hash_T hash);
+DLLIMPORT int hash_add_item(hashtab_T *ht, hashitem_T *hi, char_u *key, hash_T hash);
+DLLIMPORT hash_T hash_hash(char_u *key);
 DLLIMPORT int vim_snprintf(char *str, size_t str_m, char *fmt, ...);
 DLLIMPORT void ui_breakcheck();
+DLLIMPORT int func_call(char_u *name, typval_T *args, dict_T *selfdict, typval_T *rettv);
+DLLIMPORT void set_var(char_u *name, typval_T *tv, int copy);
+DLLIMPORT void discard_current_exception();
+DLLIMPORT void free_global_msglist();
+DLLIMPORT buf_T *buflist_findnr(int nr);
+DLLIMPORT char_u *ml_get_buf(buf_T *buf, linenr_T lnum, int will_change);
+DLLIMPORT int ml_append(linenr_T lnum, char_u *line, colnr_T len, int newfile);
+DLLIMPORT int ml_replace(linenr_T lnum, char_u *line, int copy);
+DLLIMPORT int ml_delete(linenr_T lnum, int message);
+DLLIMPORT int u_save(linenr_T top, linenr_T bot);
+DLLIMPORT void mark_adjust(linenr_T line1, linenr_T line2, long amount, long amount_after);
+DLLIMPORT void changed_lines(linenr_T lnum, colnr_T col, linenr_T lnume, long xtra);
+DLLIMPORT void switch_buffer(buf_T **save_curbuf, buf_T *buf);
+DLLIMPORT void restore_buffer(buf_T *save_curbuf);
+DLLIMPORT void check_cursor();
+DLLIMPORT int get_option_value(char_u *name, long *numval, char_u **stringval, int opt_flags);
 #ifdef __cplusplus
 }
 #endif
@@ -464,6 +544,43 @@ list_append(
     item->li_next = NULL;
 }
 
+/*
+ * Add a watcher to a list.
+ */
+    static void
+list_add_watch(
+    list_T	*l,
+    listwatch_T	*lw
+    )
+{
+    lw->lw_next = l->lv_watch;
+    l->lv_watch = lw;
+}
+
+/*
+ * Remove a watcher from a list.
+ * No warning when it isn't found...
+ */
+    static void
+list_rem_watch(
+    list_T	*l,
+    listwatch_T	*lwrem
+    )
+{
+    listwatch_T	*lw, **lwp;
+
+    lwp = &l->lv_watch;
+    for (lw = l->lv_watch; lw != NULL; lw = lw->lw_next)
+    {
+	if (lw == lwrem)
+	{
+	    *lwp = lw->lw_next;
+	    break;
+	}
+	lwp = &lw->lw_next;
+    }
+}
+
 /*
  * Just before removing an item from a list: advance watchers to the next
  * item.
@@ -669,6 +786,10 @@ func_ref(
     dictitem_T *di;
     hashitem_T *hi;
     char exprbuf[] = "let g:X__if_v8_func2 = g:X__if_v8_func1";
+
+    /* Only numbered functions (dict functions) are reference counted. */
+    if (name == NULL || !(*name >= '0' && *name <= '9'))
+	return;
     tv.v_type = VAR_FUNC;
     tv.v_lock = 0;
     tv.vval.v_string = name;
@@ -36,6 +36,8 @@ const char *send_key(const char *args);
 #include <cstdlib>
 #include <cctype>
 
+#include "vp_scan.c"
+
 namespace vp {
 
 using namespace std;
@@ -47,6 +49,7 @@ typedef vector<unsigned char> buf_t;
 class iobuf_t {
   stringstream m_strm;
   string m_str;
+  string m_val;   // reused for decoding number
 
 public:
   iobuf_t(const string& s = "")
@@ -63,15 +66,15 @@ public:
   stringstream& strm() {
     return m_strm;
   }
-  template <typename T>
-  iobuf_t& operator >> (T& var) {
-    stringstream tmp;
-    string s;
-
-    getline(m_strm, s, EOV);
-    tmp << s;
-    tmp >> var;
-    if (!tmp.eof())
+  iobuf_t& operator >> (int& var) {
+    getline(m_strm, m_val, EOV);
+    if (vp_scan_int(m_val.data(), m_val.data() + m_val.size(), &var) != 0)
+      throw logic_error("format error");
+    return *this;
+  }
+  iobuf_t& operator >> (void*& var) {
+    getline(m_strm, m_val, EOV);
+    if (vp_scan_ptr(m_val.data(), m_val.data() + m_val.size(), &var) != 0)
       throw logic_error("format error");
     return *this;
   }
@@ -80,17 +83,18 @@ public:
     return *this;
   }
   iobuf_t& operator >> (buf_t& var) {
-    char tmp[3] = {0,};
-    string s;
+    int hi, lo;
 
-    getline(m_strm, s, EOV);
-    var.clear();
-    for (const char *p = s.c_str(); *p; p += 2) {
-      if (!isxdigit(p[0]) || !isxdigit(p[1]))
+    getline(m_strm, m_val, EOV);
+    if (m_val.size() % 2 != 0)
+      throw logic_error("format error");
+    var.resize(m_val.size() / 2);
+    for (size_t i = 0; i < var.size(); ++i) {
+      hi = vp_scan_xdigit(m_val[i * 2]);
+      lo = vp_scan_xdigit(m_val[i * 2 + 1]);
+      if (hi < 0 || lo < 0)
         throw logic_error("format error");
-      tmp[0] = p[0];
-      tmp[1] = p[1];
-      var.push_back(strtol(tmp, 0, 16));
+      var[i] = (hi << 4) | lo;
     }
     return *this;
   }
@@ -6,6 +6,8 @@
 #include <stdarg.h>
 #include <ctype.h>
 
+#include "vp_scan.c"
+
 /* FIFO stream */
 typedef struct vp_iobuf_t vp_iobuf_t;
 struct vp_iobuf_t {
@@ -29,9 +31,8 @@ static void vp_iobuf_reset(vp_iobuf_t *self, const char *data);
 static void vp_iobuf_reserve(vp_iobuf_t *self, size_t size);
 static void vp_iobuf_get_str(vp_iobuf_t *self, char **pstr);
 static void vp_iobuf_get_bin(vp_iobuf_t *self, char **pbuf, size_t *psize);
-static void vp_iobuf_get_fmt(vp_iobuf_t *self, const char *fmt, void *ptr);
-#define vp_iobuf_get_num(self, pnum) vp_iobuf_get_fmt(self, "%d", pnum)
-#define vp_iobuf_get_ptr(self, pptr) vp_iobuf_get_fmt(self, "%p", pptr)
+static void vp_iobuf_get_num(vp_iobuf_t *self, int *pnum);
+static void vp_iobuf_get_ptr(vp_iobuf_t *self, void **pptr);
 static void vp_iobuf_put_str(vp_iobuf_t *self, const char *str);
 static void vp_iobuf_put_bin(vp_iobuf_t *self, const char *buf, size_t size);
 static void vp_iobuf_put_fmt(vp_iobuf_t *self, const char *fmt, ...);
@@ -135,23 +136,16 @@ vp_iobuf_get_str(vp_iobuf_t *self, char **pstr)
 static void
 vp_iobuf_get_bin(vp_iobuf_t *self, char **pbuf, size_t *psize)
 {
-  char tmp[3] = {0,};
-  char *p;
-  size_t size = 0;
+  size_t size;
 
   if (self->err)
     return;
   vp_iobuf_get_str(self, pbuf);
   if (self->err)
     return;
-  for (p = *pbuf; *p; p += 2) {
-    if (!isxdigit(p[0]) || !isxdigit(p[1])) {
-      self->err = "vp_iobuf_get_bin: format error";
-      return;
-    }
-    tmp[0] = p[0];
-    tmp[1] = p[1];
-    (*pbuf)[size++] = strtol(tmp, 0, 16);
+  if (vp_scan_hex(*pbuf, *pbuf + strlen(*pbuf), *pbuf, &size) != 0) {
+    self->err = "vp_iobuf_get_bin: format error";
+    return;
   }
   (*pbuf)[size] = 0;
   if (psize)
@@ -159,10 +153,22 @@ vp_iobuf_get_bin(vp_iobuf_t *self, char **pbuf, size_t *psize)
 }
 
 static void
-vp_iobuf_get_fmt(vp_iobuf_t *self, const char *fmt, void *ptr)
+vp_iobuf_get_num(vp_iobuf_t *self, int *pnum)
+{
+  char *str;
+
+  if (self->err)
+    return;
+  vp_iobuf_get_str(self, &str);
+  if (self->err)
+    return;
+  if (vp_scan_int(str, str + strlen(str), pnum) != 0)
+    self->err = "vp_iobuf_get_num: format error";
+}
+
+static void
+vp_iobuf_get_ptr(vp_iobuf_t *self, void **pptr)
 {
-  char tmp[8];
-  int end;
   char *str;
 
   if (self->err)
@@ -170,10 +176,8 @@ vp_iobuf_get_fmt(vp_iobuf_t *self, const char *fmt, void *ptr)
   vp_iobuf_get_str(self, &str);
   if (self->err)
     return;
-  strcpy(tmp, fmt);
-  strcat(tmp, "%n");
-  if (sscanf(str, tmp, ptr, &end) != 1 || str[end] != 0)
-    self->err = "vp_iobuf_get_fmt: sscanf error";
+  if (vp_scan_ptr(str, str + strlen(str), pptr) != 0)
+    self->err = "vp_iobuf_get_ptr: format error";
 }
 
 static void
@@ -11,6 +11,9 @@
 
 #include <fcntl.h>
 
+/* for streaming decoder */
+#include <iconv.h>
+
 /* for poll() */
 #include <poll.h>
 
@@ -53,6 +56,7 @@ const char *vp_file_open(char *args);   /* [fd] (path, flags, mode) */
 const char *vp_file_close(char *args);  /* [] (fd) */
 const char *vp_file_read(char *args);   /* [hd, eof] (fd, nr, timeout) */
 const char *vp_file_write(char *args);  /* [nleft] (fd, hd, timeout) */
+const char *vp_file_set_decoder(char *args); /* [] (fd, from, to) */
 
 const char *vp_pipe_open(char *args);   /* [pid, [fd] * npipe]
                                            (npipe, argc, [argv]) */
@@ -67,6 +71,7 @@ const char *vp_pty_read(char *args);    /* [hd, eof] (fd, nr, timeout) */
 const char *vp_pty_write(char *args);   /* [nleft] (fd, hd, timeout) */
 const char *vp_pty_get_winsize(char *args); /* [width, height] (fd) */
 const char *vp_pty_set_winsize(char *args); /* [] (fd, width, height) */
+const char *vp_pty_set_throttle(char *args); /* [] (fd, nlines, scrollback) */
 
 const char *vp_kill(char *args);        /* [] (pid, sig) */
 const char *vp_waitpid(char *args);     /* [cond, status] (pid) */
@@ -79,8 +84,59 @@ const char *vp_socket_write(char *args);/* [nleft] (socket, hd, timeout) */
 
 #define VP_ARGC_MAX 20
 #define VP_READ_BUFSIZE 2048
+/* max bytes drained from a throttled pty in one read call */
+#define VP_THROTTLE_DRAIN_MAX (4 * 1024 * 1024)
+/* max bytes kept even when lines are very long */
+#define VP_THROTTLE_KEEP_MAX (256 * 1024)
+/* msec to wait for a busy scrollback file before dropping it */
+#define VP_THROTTLE_SPILL_TIMEOUT 100
+
+/*
+ * Output throttling for pty.  When set, vp_pty_read() drains the pty without
+ * waiting and returns only the last nlines lines.  The scrolled-off head is
+ * appended to the scrollback file or discarded.
+ */
+typedef struct vp_throttle_t {
+    struct vp_throttle_t *next;
+    int fd;
+    int nlines;
+    int spill;      /* scrollback file or -1 */
+    char *buf;      /* buf:dropped|off:kept|len:free|size */
+    size_t off;
+    size_t len;
+    size_t size;
+    int nl;         /* number of newlines in kept */
+} vp_throttle_t;
+
+/*
+ * Streaming decoder.  When set, reads return converted text instead of
+ * hexdump.  A multibyte sequence split across reads is kept in pending and
+ * completed by the next read.
+ */
+typedef struct vp_decoder_t {
+    struct vp_decoder_t *next;
+    int fd;
+    iconv_t cd;
+    char pending[16];
+    size_t npending;
+} vp_decoder_t;
 
 static vp_stack_t _result = VP_STACK_NULL;
+static vp_throttle_t *_throttle = NULL;
+static vp_decoder_t *_decoder = NULL;
+
+static vp_throttle_t *vp_throttle_find(int fd);
+static void vp_throttle_free(int fd);
+static const char *vp_throttle_append(vp_throttle_t *th, const char *buf, size_t size);
+static void vp_throttle_drop(vp_throttle_t *th, size_t size);
+static const char *vp_throttle_read(vp_throttle_t *th, int timeout);
+
+static vp_decoder_t *vp_decoder_find(int fd);
+static void vp_decoder_free(int fd);
+static const char *vp_decoder_push(vp_decoder_t *dec, vp_stack_t *stack, const char *buf, size_t size);
+static const char *vp_decoder_flush(vp_decoder_t *dec, vp_stack_t *stack);
+static const char *vp_decoder_eof(vp_decoder_t *dec);
+static const char *vp_decoder_error(const char *err);
 
 const char *
 vp_dlopen(char *args)
@@ -90,7 +146,7 @@ vp_dlopen(char *args)
     void *handle;
 
     VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
-    VP_RETURN_IF_FAIL(vp_stack_pop_str(&stack, &path));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "s", &path));
 
     handle = dlopen(path, RTLD_LAZY);
     if (handle == NULL)
@@ -106,7 +162,7 @@ vp_dlclose(char *args)
     void *handle;
 
     VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%p", &handle));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "p", &handle));
 
     /* On FreeBSD6, to call dlclose() twice with same pointer causes SIGSEGV */
     if (dlclose(handle) == -1)
@@ -126,9 +182,7 @@ vp_file_open(char *args)
     int fd;
 
     VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
-    VP_RETURN_IF_FAIL(vp_stack_pop_str(&stack, &path));
-    VP_RETURN_IF_FAIL(vp_stack_pop_str(&stack, &flags));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &mode));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "ssd", &path, &flags, &mode));
 
 #ifdef O_RDONLY
     if (strstr(flags, "O_RDONLY"))      f |= O_RDONLY;
@@ -206,8 +260,9 @@ vp_file_close(char *args)
     int fd;
 
     VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &fd));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "d", &fd));
 
+    vp_decoder_free(fd);
     if (close(fd) == -1)
         return vp_stack_return_error(&_result, "close() error: %s",
                 strerror(errno));
@@ -224,13 +279,13 @@ vp_file_read(char *args)
     int n;
     char buf[VP_READ_BUFSIZE];
     struct pollfd pfd = {0, POLLIN, 0};
+    vp_decoder_t *dec;
 
     VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &fd));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &nr));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &timeout));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "ddd", &fd, &nr, &timeout));
 
     pfd.fd = fd;
+    dec = vp_decoder_find(fd);
     vp_stack_push_str(&_result, ""); /* initialize */
     while (nr != 0) {
         n = poll(&pfd, 1, timeout);
@@ -252,12 +307,19 @@ vp_file_read(char *args)
                         strerror(errno));
             } else if (n == 0) {
                 /* eof */
+                VP_RETURN_IF_FAIL(vp_decoder_eof(dec));
                 vp_stack_push_num(&_result, "%d", 1);
                 return vp_stack_return(&_result);
             }
             /* decrease stack top for concatenate. */
             _result.top--;
-            vp_stack_push_bin(&_result, buf, n);
+            if (dec != NULL) {
+                const char *err = vp_decoder_push(dec, &_result, buf, n);
+                if (err != NULL)
+                    return vp_decoder_error(err);
+            } else {
+                vp_stack_push_bin(&_result, buf, n);
+            }
             if (nr > 0)
                 nr -= n;
             /* try read more bytes without waiting */
@@ -265,6 +327,7 @@ vp_file_read(char *args)
             continue;
         } else if (pfd.revents & (POLLERR | POLLHUP)) {
             /* eof or error */
+            VP_RETURN_IF_FAIL(vp_decoder_eof(dec));
             vp_stack_push_num(&_result, "%d", 1);
             return vp_stack_return(&_result);
         } else if (pfd.revents & POLLNVAL) {
@@ -292,9 +355,8 @@ vp_file_write(char *args)
     struct pollfd pfd = {0, POLLOUT, 0};
 
     VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &fd));
-    VP_RETURN_IF_FAIL(vp_stack_pop_bin(&stack, &buf, &size));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &timeout));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "dbd",
+                &fd, &buf, &size, &timeout));
 
     pfd.fd = fd;
     nleft = 0;
@@ -332,6 +394,41 @@ vp_file_write(char *args)
     return vp_stack_return(&_result);
 }
 
+/* from "" disables decoder. */
+const char *
+vp_file_set_decoder(char *args)
+{
+    vp_stack_t stack;
+    int fd;
+    char *from;
+    char *to;
+    iconv_t cd;
+    vp_decoder_t *dec;
+
+    VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "dss", &fd, &from, &to));
+
+    vp_decoder_free(fd);
+    if (from[0] == '\0')
+        return NULL;
+
+    cd = iconv_open(to, from);
+    if (cd == (iconv_t)-1)
+        return vp_stack_return_error(&_result, "iconv_open() error: %s",
+                strerror(errno));
+    dec = (vp_decoder_t *)malloc(sizeof(vp_decoder_t));
+    if (dec == NULL) {
+        iconv_close(cd);
+        return "vp_file_set_decoder: NOMEM";
+    }
+    dec->fd = fd;
+    dec->cd = cd;
+    dec->npending = 0;
+    dec->next = _decoder;
+    _decoder = dec;
+    return NULL;
+}
+
 const char *
 vp_pipe_open(char *args)
 {
@@ -344,14 +441,14 @@ vp_pipe_open(char *args)
     int i;
 
     VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &npipe));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "d", &npipe));
     if (npipe != 2 && npipe != 3)
         return vp_stack_return_error(&_result, "npipe range error");
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &argc));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "d", &argc));
     if (argc < 1 || VP_ARGC_MAX <= argc)
         return vp_stack_return_error(&_result, "argc range error");
     for (i = 0; i < argc; ++i)
-        VP_RETURN_IF_FAIL(vp_stack_pop_str(&stack, &(argv[i])));
+        VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "s", &(argv[i])));
     argv[argc] = NULL;
 
     if (pipe(fd[0]) < 0 || pipe(fd[1]) < 0 || (npipe == 3 && pipe(fd[2]) < 0))
@@ -447,13 +544,12 @@ vp_pty_open(char *args)
     int i;
 
     VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%hu", &(ws.ws_col)));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%hu", &(ws.ws_row)));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &argc));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "hhd",
+                &(ws.ws_col), &(ws.ws_row), &argc));
     if (argc < 1 || VP_ARGC_MAX <= argc)
         return "argv is out of range";
     for (i = 0; i < argc; ++i)
-        VP_RETURN_IF_FAIL(vp_stack_pop_str(&stack, &(argv[i])));
+        VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "s", &(argv[i])));
     argv[argc] = NULL;
 
 #if 0
@@ -490,13 +586,33 @@ vp_pty_open(char *args)
 const char *
 vp_pty_close(char *args)
 {
+    vp_stack_t stack;
+    int fd;
+
+    VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "d", &fd));
+
+    vp_throttle_free(fd);
     return vp_file_close(args);
 }
 
 const char *
 vp_pty_read(char *args)
 {
-    return vp_file_read(args);
+    vp_stack_t stack;
+    int fd;
+    int nr;
+    int timeout;
+    vp_throttle_t *th;
+
+    VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "ddd", &fd, &nr, &timeout));
+
+    th = vp_throttle_find(fd);
+    if (th == NULL)
+        return vp_file_read(args);
+    /* nr is ignored.  The result is bounded by nlines. */
+    return vp_throttle_read(th, timeout);
 }
 
 const char *
@@ -513,7 +629,7 @@ vp_pty_get_winsize(char *args)
     struct winsize ws = {0, 0, 0, 0};
 
     VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &fd));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "d", &fd));
 
     if (ioctl(fd, TIOCGWINSZ, &ws) < 0)
         return vp_stack_return_error(&_result, "ioctl() error: %s",
@@ -530,9 +646,8 @@ vp_pty_set_winsize(char *args)
     struct winsize ws = {0, 0, 0, 0};
 
     VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &fd));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%hu", &(ws.ws_col)));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%hu", &(ws.ws_row)));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "dhh",
+                &fd, &(ws.ws_col), &(ws.ws_row)));
 
     if (ioctl(fd, TIOCSWINSZ, &ws) < 0)
         return vp_stack_return_error(&_result, "ioctl() error: %s",
@@ -540,6 +655,223 @@ vp_pty_set_winsize(char *args)
     return NULL;
 }
 
+/* nlines <= 0 disables throttling.  scrollback "" discards dropped lines. */
+const char *
+vp_pty_set_throttle(char *args)
+{
+    vp_stack_t stack;
+    int fd;
+    int nlines;
+    char *path;
+    int spill = -1;
+    vp_throttle_t *th;
+
+    VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "dds", &fd, &nlines, &path));
+
+    vp_throttle_free(fd);
+    if (nlines <= 0)
+        return NULL;
+
+    if (path[0] != '\0') {
+        spill = open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+        if (spill == -1)
+            return vp_stack_return_error(&_result, "open() error: %s",
+                    strerror(errno));
+    }
+    th = (vp_throttle_t *)malloc(sizeof(vp_throttle_t));
+    if (th == NULL) {
+        if (spill != -1)
+            close(spill);
+        return "vp_pty_set_throttle: NOMEM";
+    }
+    th->fd = fd;
+    th->nlines = nlines;
+    th->spill = spill;
+    th->buf = NULL;
+    th->off = 0;
+    th->len = 0;
+    th->size = 0;
+    th->nl = 0;
+    th->next = _throttle;
+    _throttle = th;
+    return NULL;
+}
+
+static vp_throttle_t *
+vp_throttle_find(int fd)
+{
+    vp_throttle_t *th;
+
+    for (th = _throttle; th != NULL; th = th->next)
+        if (th->fd == fd)
+            return th;
+    return NULL;
+}
+
+static void
+vp_throttle_free(int fd)
+{
+    vp_throttle_t **pth;
+    vp_throttle_t *th;
+
+    for (pth = &_throttle; *pth != NULL; pth = &(*pth)->next) {
+        if ((*pth)->fd == fd) {
+            th = *pth;
+            *pth = th->next;
+            if (th->spill != -1)
+                close(th->spill);
+            free(th->buf);
+            free(th);
+            return;
+        }
+    }
+}
+
+/* drop size bytes from the head of kept data */
+static void
+vp_throttle_drop(vp_throttle_t *th, size_t size)
+{
+    char *p = th->buf + th->off;
+    size_t nleft;
+    size_t i;
+    int n;
+    struct pollfd pfd = {0, POLLOUT, 0};
+
+    /* scrollback is best effort: stop spilling on error or timeout */
+    pfd.fd = th->spill;
+    nleft = 0;
+    while (th->spill != -1 && nleft < size) {
+        n = write(th->spill, p + nleft, size - nleft);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        } else if (n == -1 && errno == EAGAIN
+                && poll(&pfd, 1, VP_THROTTLE_SPILL_TIMEOUT) > 0
+                && (pfd.revents & POLLOUT)) {
+            continue;
+        } else if (n == -1) {
+            close(th->spill);
+            th->spill = -1;
+            break;
+        }
+        nleft += n;
+    }
+    for (i = 0; i < size; ++i)
+        if (p[i] == '\n')
+            --th->nl;
+    th->off += size;
+}
+
+static const char *
+vp_throttle_append(vp_throttle_t *th, const char *buf, size_t size)
+{
+    char *p;
+    size_t i;
+    int ndrop;
+
+    /* compact dropped head before growing */
+    if (th->len + size > th->size && th->off != 0) {
+        memmove(th->buf, th->buf + th->off, th->len - th->off);
+        th->len -= th->off;
+        th->off = 0;
+    }
+    if (th->len + size > th->size) {
+        size_t newsize = (th->size == 0) ? VP_INITIAL_BUFSIZE : th->size;
+        char *newbuf;
+
+        while (th->len + size > newsize)
+            newsize *= 2;
+        if ((newbuf = (char *)realloc(th->buf, newsize)) == NULL)
+            return "vp_throttle_append: NOMEM";
+        th->buf = newbuf;
+        th->size = newsize;
+    }
+    memcpy(th->buf + th->len, buf, size);
+    th->len += size;
+    for (i = 0; i < size; ++i)
+        if (buf[i] == '\n')
+            ++th->nl;
+
+    /* keep a trailing partial line and the last nlines lines */
+    if (th->nl > th->nlines) {
+        ndrop = th->nl - th->nlines;
+        for (p = th->buf + th->off; ndrop > 0; ++p)
+            if (*p == '\n')
+                --ndrop;
+        vp_throttle_drop(th, p - (th->buf + th->off));
+    }
+    if (th->len - th->off > VP_THROTTLE_KEEP_MAX)
+        vp_throttle_drop(th, th->len - th->off - VP_THROTTLE_KEEP_MAX);
+    return NULL;
+}
+
+static const char *
+vp_throttle_read(vp_throttle_t *th, int timeout)
+{
+    int n;
+    int eof = 0;
+    size_t total = 0;
+    char buf[VP_READ_BUFSIZE];
+    struct pollfd pfd = {0, POLLIN, 0};
+    vp_decoder_t *dec;
+    const char *err;
+
+    pfd.fd = th->fd;
+    th->off = 0;
+    th->len = 0;
+    th->nl = 0;
+    while (total < VP_THROTTLE_DRAIN_MAX) {
+        n = poll(&pfd, 1, timeout);
+        if (n == -1) {
+            return vp_stack_return_error(&_result, "poll() error: %s",
+                    strerror(errno));
+        } else if (n == 0) {
+            /* timeout or drained */
+            break;
+        }
+        if (pfd.revents & POLLIN) {
+            n = read(th->fd, buf, VP_READ_BUFSIZE);
+            if (n == -1) {
+                return vp_stack_return_error(&_result, "read() error: %s",
+                        strerror(errno));
+            } else if (n == 0) {
+                eof = 1;
+                break;
+            }
+            VP_RETURN_IF_FAIL(vp_throttle_append(th, buf, n));
+            total += n;
+            /* drain without waiting */
+            timeout = 0;
+            continue;
+        } else if (pfd.revents & (POLLERR | POLLHUP)) {
+            /* eof or error */
+            eof = 1;
+            break;
+        } else if (pfd.revents & POLLNVAL) {
+            return vp_stack_return_error(&_result, "poll() POLLNVAL: %d",
+                    pfd.revents);
+        }
+        /* DO NOT REACH HERE */
+        return vp_stack_return_error(&_result, "poll() unknown status: %d",
+                pfd.revents);
+    }
+    dec = vp_decoder_find(th->fd);
+    if (dec != NULL) {
+        vp_stack_push_str(&_result, "");
+        _result.top--;
+        err = vp_decoder_push(dec, &_result,
+                th->buf + th->off, th->len - th->off);
+        if (err != NULL)
+            return vp_decoder_error(err);
+        if (eof)
+            VP_RETURN_IF_FAIL(vp_decoder_eof(dec));
+    } else {
+        vp_stack_push_bin(&_result, th->buf + th->off, th->len - th->off);
+    }
+    vp_stack_push_num(&_result, "%d", eof);
+    return vp_stack_return(&_result);
+}
+
 const char *
 vp_kill(char *args)
 {
@@ -548,8 +880,7 @@ vp_kill(char *args)
     int sig;
 
     VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &pid));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &sig));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "dd", &pid, &sig));
 
     if (kill(pid, sig) == -1)
         return vp_stack_return_error(&_result, "kill() error: %s",
@@ -566,7 +897,7 @@ vp_waitpid(char *args)
     int status;
 
     VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &pid));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "d", &pid));
 
     n = waitpid(pid, &status, WNOHANG | WUNTRACED);
     if (n == -1)
@@ -610,8 +941,7 @@ vp_socket_open(char *args)
     struct servent *servent;
 
     VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
-    VP_RETURN_IF_FAIL(vp_stack_pop_str(&stack, &host));
-    VP_RETURN_IF_FAIL(vp_stack_pop_str(&stack, &port));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "ss", &host, &port));
 
     n = strtol(port, &p, 10);
     if (p == port + strlen(port)) {
@@ -657,3 +987,159 @@ vp_socket_write(char *args)
     return vp_file_write(args);
 }
 
+
+static vp_decoder_t *
+vp_decoder_find(int fd)
+{
+    vp_decoder_t *dec;
+
+    for (dec = _decoder; dec != NULL; dec = dec->next)
+        if (dec->fd == fd)
+            return dec;
+    return NULL;
+}
+
+static void
+vp_decoder_free(int fd)
+{
+    vp_decoder_t **pdec;
+    vp_decoder_t *dec;
+
+    for (pdec = &_decoder; *pdec != NULL; pdec = &(*pdec)->next) {
+        if ((*pdec)->fd == fd) {
+            dec = *pdec;
+            *pdec = dec->next;
+            iconv_close(dec->cd);
+            free(dec);
+            return;
+        }
+    }
+}
+
+static char vp_decoder_errbuf[VP_ERRMSG_SIZE];
+
+/*
+ * Convert buf and push it as text.  Since Vim can not handle \x00 byte,
+ * remove it.  \xFF is EOV and is replaced with '?'.  Invalid sequence is
+ * also replaced with '?'.  On error the stack is left half built; the
+ * caller drops it with vp_decoder_error().
+ */
+static const char *
+vp_decoder_push(vp_decoder_t *dec, vp_stack_t *stack, const char *buf,
+        size_t size)
+{
+    char *joined = NULL;
+    char *inbuf;
+    size_t inleft;
+    char *outbuf;
+    size_t outleft;
+    size_t start;
+    size_t needsize;
+    char *p;
+    char *q;
+
+    if (dec->npending != 0) {
+        if ((joined = (char *)malloc(dec->npending + size)) == NULL)
+            return "vp_decoder_push: NOMEM";
+        memcpy(joined, dec->pending, dec->npending);
+        memcpy(joined + dec->npending, buf, size);
+        inbuf = joined;
+        inleft = dec->npending + size;
+        dec->npending = 0;
+    } else {
+        inbuf = (char *)buf;
+        inleft = size;
+    }
+
+    start = stack->top - stack->buf;
+    /* 4 bytes per input byte is enough for most conversions. */
+    needsize = start + (inleft * 4) + sizeof(VP_EOV_STR);
+    while (inleft > 0) {
+        if (vp_stack_reserve(stack, needsize) != NULL) {
+            free(joined);
+            return "vp_decoder_push: NOMEM";
+        }
+        outbuf = stack->top;
+        outleft = stack->size - (stack->top - stack->buf) - sizeof(VP_EOV_STR);
+        if (iconv(dec->cd, &inbuf, &inleft, &outbuf, &outleft) != (size_t)-1) {
+            stack->top = outbuf;
+            break;
+        }
+        stack->top = outbuf;
+        if (errno == EINVAL) {
+            /* incomplete sequence at the end: keep for next read */
+            if (inleft <= sizeof(dec->pending)) {
+                memcpy(dec->pending, inbuf, inleft);
+                dec->npending = inleft;
+                break;
+            }
+            errno = EILSEQ;
+        }
+        if (errno == EILSEQ) {
+            if (outleft == 0) {
+                needsize = stack->size + 1;
+                continue;
+            }
+            *(stack->top++) = '?';
+            ++inbuf;
+            --inleft;
+        } else if (errno == E2BIG) {
+            needsize = stack->size * 2;
+        } else {
+            snprintf(vp_decoder_errbuf, sizeof(vp_decoder_errbuf),
+                    "iconv() error: %s", strerror(errno));
+            free(joined);
+            return vp_decoder_errbuf;
+        }
+    }
+    free(joined);
+
+    for (p = q = stack->buf + start; p < stack->top; ++p) {
+        if (*p == '\0')
+            continue;
+        *q++ = (*p == VP_EOV) ? '?' : *p;
+    }
+    stack->top = q;
+    *(stack->top++) = VP_EOV;
+    return NULL;
+}
+
+/* Emit pending bytes of a truncated sequence as '?' to the last value. */
+static const char *
+vp_decoder_flush(vp_decoder_t *dec, vp_stack_t *stack)
+{
+    size_t i;
+
+    if (dec->npending == 0)
+        return NULL;
+    if (vp_stack_reserve(stack, (stack->top - stack->buf) + dec->npending)
+            != NULL)
+        return "vp_decoder_flush: NOMEM";
+    /* overwrite EOV of the last value */
+    stack->top--;
+    for (i = 0; i < dec->npending; ++i)
+        *(stack->top++) = '?';
+    *(stack->top++) = VP_EOV;
+    dec->npending = 0;
+    return NULL;
+}
+
+/* Called at eof of the fd of dec (may be NULL) before pushing eof flag. */
+static const char *
+vp_decoder_eof(vp_decoder_t *dec)
+{
+    const char *err;
+
+    if (dec == NULL)
+        return NULL;
+    err = vp_decoder_flush(dec, &_result);
+    return (err == NULL) ? NULL : vp_decoder_error(err);
+}
+
+/* Drop the half built result and return err as error message. */
+static const char *
+vp_decoder_error(const char *err)
+{
+    _result.top = _result.buf;
+    return vp_stack_return_error(&_result, "%s", err);
+}
@@ -42,7 +42,16 @@ function! s:lib.read(...)
   let timeout = get(a:000, 1, self.read_timeout)
   let [hd, eof] = self.f_read(self.fd, nr, timeout)
   let self.eof = eof
-  return self.hd2str(hd)
+  " converted text is returned as is
+  return self.decoder ? hd : self.hd2str(hd)
+endfunction
+
+" Convert read data from encoding "from" to "to" (default &encoding) in
+" proc.so.  Empty "from" disables conversion.
+function! s:lib.set_decoder(from, ...)
+  let to = get(a:000, 0, &encoding)
+  call self.api.vp_file_set_decoder(self.fd, a:from, to)
+  let self.decoder = (a:from != "")
 endfunction
 
 function! s:lib.write(str, ...)
@@ -80,6 +89,7 @@ function! s:lib.fdopen(fd, f_close, f_read, f_write)
   call extend(file, self.api)
   let file.fd = a:fd
   let file.eof = 0
+  let file.decoder = 0
   let file.f_close = a:f_close
   let file.f_read = a:f_read
   let file.f_write = a:f_write
@@ -95,6 +105,13 @@ function! s:lib.ptyopen(args)
   return proc
 endfunction
 
+" Keep only the last nlines lines for each read.  Dropped lines are appended
+" to scrollback file if given.  nlines 0 disables throttling.
+function! s:lib.throttle(nlines, ...)
+  let scrollback = get(a:000, 0, "")
+  call self.api.vp_pty_set_throttle(self.fd, a:nlines, scrollback)
+endfunction
+
 
 
 "-----------------------------------------------------------
@@ -208,6 +225,10 @@ function! s:lib.api.vp_file_write(fd, hd, timeout)
   return nleft
 endfunction
 
+function! s:lib.api.vp_file_set_decoder(fd, from, to)
+  call self.libcall("vp_file_set_decoder", [a:fd, a:from, a:to])
+endfunction
+
 function! s:lib.api.vp_pipe_open(npipe, argv)
   if has("win32")
     let cmdline = ""
@@ -265,6 +286,10 @@ function! s:lib.api.vp_pty_set_winsize(fd, width, height)
   call self.libcall("vp_pty_set_winsize", [a:fd, a:width, a:height])
 endfunction
 
+function! s:lib.api.vp_pty_set_throttle(fd, nlines, scrollback)
+  call self.libcall("vp_pty_set_throttle", [a:fd, a:nlines, a:scrollback])
+endfunction
+
 function! s:lib.api.vp_kill(pid, sig)
   call self.libcall("vp_kill", [a:pid, a:sig])
 endfunction
@@ -34,6 +34,7 @@ EXPORT const char *vp_file_open(char *args);   /* [fd] (path, flags, mode) */
 EXPORT const char *vp_file_close(char *args);  /* [] (fd) */
 EXPORT const char *vp_file_read(char *args);   /* [hd, eof] (fd, nr, timeout) */
 EXPORT const char *vp_file_write(char *args);  /* [nleft] (fd, hd, timeout) */
+EXPORT const char *vp_file_set_decoder(char *args); /* [] (fd, from, to) */
 
 EXPORT const char *vp_pipe_open(char *args);   /* [pid, [fd] * npipe]
                                                   (npipe, argc, [argv]) */
@@ -48,6 +49,7 @@ EXPORT const char *vp_pty_read(char *args);    /* [hd, eof] (fd, nr, timeout) */
 EXPORT const char *vp_pty_write(char *args);   /* [nleft] (fd, hd, timeout) */
 EXPORT const char *vp_pty_get_winsize(char *args); /* [width, height] (fd) */
 EXPORT const char *vp_pty_set_winsize(char *args); /* [] (fd, width, height) */
+EXPORT const char *vp_pty_set_throttle(char *args); /* [] (fd, nlines, scrollback) */
 
 EXPORT const char *vp_kill(char *args);        /* [] (pid, sig) */
 EXPORT const char *vp_waitpid(char *args);     /* [cond, status] (pid) */
@@ -86,7 +88,7 @@ vp_dlopen(char *args)
     HINSTANCE handle;
 
     VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
-    VP_RETURN_IF_FAIL(vp_stack_pop_str(&stack, &path));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "s", &path));
 
     handle = LoadLibrary(path);
     if (handle == NULL)
@@ -102,7 +104,7 @@ vp_dlclose(char *args)
     HINSTANCE handle;
 
     VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%p", &handle));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "p", &handle));
 
     if (!FreeLibrary(handle))
         return lasterror();
@@ -122,9 +124,7 @@ vp_file_open(char *args)
     int fd;
 
     VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
-    VP_RETURN_IF_FAIL(vp_stack_pop_str(&stack, &path));
-    VP_RETURN_IF_FAIL(vp_stack_pop_str(&stack, &flags));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &mode));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "ssd", &path, &flags, &mode));
 
 #ifdef O_RDONLY
     if (strstr(flags, "O_RDONLY"))      f |= O_RDONLY;
@@ -202,7 +202,7 @@ vp_file_close(char *args)
     int fd;
 
     VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &fd));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "d", &fd));
 
     if (close(fd) == -1)
         return vp_stack_return_error(&_result, "close() error: %s",
@@ -222,9 +222,7 @@ vp_file_read(char *args)
     char buf[VP_READ_BUFSIZE];
 
     VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &fd));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &nr));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &timeout));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "ddd", &fd, &nr, &timeout));
 
     vp_stack_push_str(&_result, ""); /* initialize */
     while (nr != 0) {
@@ -273,9 +271,8 @@ vp_file_write(char *args)
     int n;
 
     VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &fd));
-    VP_RETURN_IF_FAIL(vp_stack_pop_bin(&stack, &buf, &size));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &timeout));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "dbd",
+                &fd, &buf, &size, &timeout));
 
     nleft = 0;
     while (nleft < size) {
@@ -300,6 +297,12 @@ vp_file_write(char *args)
     return vp_stack_return(&_result);
 }
 
+const char *
+vp_file_set_decoder(char *args)
+{
+    return "vp_file_set_decoder() is not available";
+}
+
 /*
  * http://support.microsoft.com/kb/190351/
  */
@@ -317,10 +320,10 @@ vp_pipe_open(char *args)
     STARTUPINFO si;
 
     VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &npipe));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "d", &npipe));
     if (npipe != 2 && npipe != 3)
         return vp_stack_return_error(&_result, "npipe range error");
-    VP_RETURN_IF_FAIL(vp_stack_pop_str(&stack, &cmdline));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "s", &cmdline));
 
     sa.nLength = sizeof(SECURITY_ATTRIBUTES);
     sa.lpSecurityDescriptor = NULL;
@@ -429,7 +432,7 @@ vp_pipe_close(char *args)
     int fd;
 
     VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &fd));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "d", &fd));
 
     if (!CloseHandle((HANDLE)_get_osfhandle(fd)))
         return vp_stack_return_error(&_result, "CloseHandle() error: %s",
@@ -448,9 +451,7 @@ vp_pipe_read(char *args)
     char buf[VP_READ_BUFSIZE];
 
     VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &fd));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &nr));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &timeout));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "ddd", &fd, &nr, &timeout));
 
     vp_stack_push_str(&_result, ""); /* initialize */
     while (nr != 0) {
@@ -533,6 +534,12 @@ vp_pty_set_winsize(char *args)
     return "vp_pty_set_winsize() is not available";
 }
 
+const char *
+vp_pty_set_throttle(char *args)
+{
+    return "vp_pty_set_throttle() is not available";
+}
+
 const char *
 vp_kill(char *args)
 {
@@ -540,7 +547,7 @@ vp_kill(char *args)
     HANDLE handle;
 
     VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%p", &handle));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "p", &handle));
 
     if (!TerminateProcess(handle, 2) || !CloseHandle(handle))
         return vp_stack_return_error(&_result, "kill() error: %s",
@@ -556,7 +563,7 @@ vp_waitpid(char *args)
     DWORD exitcode;
 
     VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%p", &handle));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "p", &handle));
 
     if (!GetExitCodeProcess(handle, &exitcode))
         return vp_stack_return_error(&_result,
@@ -589,8 +596,7 @@ vp_socket_open(char *args)
     struct servent *servent;
 
     VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
-    VP_RETURN_IF_FAIL(vp_stack_pop_str(&stack, &host));
-    VP_RETURN_IF_FAIL(vp_stack_pop_str(&stack, &port));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "ss", &host, &port));
 
     if (sockets_number++ == 0)
     {
@@ -630,7 +636,7 @@ vp_socket_close(char *args)
     int sock;
 
     VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &sock));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "d", &sock));
 
     if (closesocket(sock) == SOCKET_ERROR) {
         return vp_stack_return_error(&_result, "closesocket() error: %d",
@@ -656,9 +662,7 @@ vp_socket_read(char *args)
     fd_set fdset;
 
     VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &sock));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &nr));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &timeout));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "ddd", &sock, &nr, &timeout));
     tv.tv_sec = timeout / 1000;
     tv.tv_usec = (timeout - tv.tv_sec * 1000) * 1000;
 
@@ -713,9 +717,8 @@ vp_socket_write(char *args)
     fd_set fdset;
 
     VP_RETURN_IF_FAIL(vp_stack_from_args(&stack, args));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &sock));
-    VP_RETURN_IF_FAIL(vp_stack_pop_bin(&stack, &buf, &size));
-    VP_RETURN_IF_FAIL(vp_stack_pop_num(&stack, "%d", &timeout));
+    VP_RETURN_IF_FAIL(vp_stack_pop_args(&stack, "dbd",
+                &sock, &buf, &size, &timeout));
     tv.tv_sec = timeout / 1000;
     tv.tv_usec = (timeout - tv.tv_sec * 1000) * 1000;
 
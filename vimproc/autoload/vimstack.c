@@ -7,6 +7,13 @@
 #include <stddef.h>
 #include <stdarg.h>
 #include <errno.h>
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <sys/mman.h>
+#endif
+
+#include "vp_scan.c"
 
 /*
  * Argument and Result are Stack. Each value is EOV terminated String.
@@ -20,9 +27,9 @@
 #define VP_EOV_STR "\xFF"
 
 #define VP_NUM_BUFSIZE 64
-#define VP_NUMFMT_BUFSIZE 16
 #define VP_INITIAL_BUFSIZE 512
 #define VP_ERRMSG_SIZE 512
+#define VP_WARM_BUFSIZE (64 * 1024)
 
 #define VP_RETURN_IF_FAIL(expr)     \
     do {                            \
@@ -35,39 +42,74 @@ typedef struct vp_stack_t {
     size_t size; /* stack size */
     char *buf;   /* stack bufffer */
     char *top;   /* stack top */
+    int mapped;  /* buf is dedicated mapping */
 } vp_stack_t;
 
 /* use for initialize */
-#define VP_STACK_NULL {0, NULL, NULL}
-static vp_stack_t vp_stack_null = {0, NULL, NULL};
+#define VP_STACK_NULL {0, NULL, NULL, 0}
+static vp_stack_t vp_stack_null = {0, NULL, NULL, 0};
+
+/*
+ * Result buffer is a warm chunk which is reused by every call.  A result
+ * which does not fit in it gets a dedicated mapping.  The mapping is
+ * released when the next result is started, so memory returns to the
+ * system after a large transfer.  Since the warm chunk is shared, only one
+ * writable stack can be used at a time.
+ */
+static char vp_stack_warm[VP_WARM_BUFSIZE];
 
 static void vp_stack_free(vp_stack_t *stack);
 static const char *vp_stack_from_args(vp_stack_t *stack, char *args);
 static const char *vp_stack_return(vp_stack_t *stack);
 static const char *vp_stack_return_error(vp_stack_t *stack, const char *fmt, ...);
 static const char *vp_stack_reserve(vp_stack_t *stack, size_t needsize);
-static const char *vp_stack_pop_num(vp_stack_t *stack, const char *fmt, void *ptr);
-static const char *vp_stack_pop_str(vp_stack_t *stack, char **str);
-static const char *vp_stack_pop_bin(vp_stack_t *stack, char **buf, size_t *size);
+static const char *vp_stack_pop_val(vp_stack_t *stack, char **pval, char **pend);
+static const char *vp_stack_pop_args(vp_stack_t *stack, const char *sig, ...);
 static const char *vp_stack_push_num(vp_stack_t *stack, const char *fmt, ...);
 static const char *vp_stack_push_str(vp_stack_t *stack, const char *str);
 static const char *vp_stack_push_bin(vp_stack_t *stack, const char *buf, size_t size);
+static char *vp_stack_map(size_t size);
+static void vp_stack_unmap(char *buf, size_t size);
+
+static char *
+vp_stack_map(size_t size)
+{
+#ifdef _WIN32
+    return (char *)VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE,
+            PAGE_READWRITE);
+#else
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANON, -1, 0);
+    return (p == MAP_FAILED) ? NULL : (char *)p;
+#endif
+}
+
+static void
+vp_stack_unmap(char *buf, size_t size)
+{
+#ifdef _WIN32
+    VirtualFree(buf, 0, MEM_RELEASE);
+#else
+    munmap(buf, size);
+#endif
+}
 
 static void
 vp_stack_free(vp_stack_t *stack)
 {
-    if (stack->buf != NULL) {
-        free((void *)stack->buf);
-        stack->size = 0;
-        stack->buf = NULL;
-        stack->top = NULL;
-    }
+    if (stack->mapped)
+        vp_stack_unmap(stack->buf, stack->size);
+    stack->size = 0;
+    stack->buf = NULL;
+    stack->top = NULL;
+    stack->mapped = 0;
 }
 
 /* make readonly stack from arguments */
 static const char *
 vp_stack_from_args(vp_stack_t *stack, char *args)
 {
+    stack->mapped = 0;
     if (args == NULL || args[0] == '\0') {
         stack->size = 0;
         stack->buf = NULL;
@@ -116,126 +158,151 @@ vp_stack_return_error(vp_stack_t *stack, const char *fmt, ...)
 static const char *
 vp_stack_reserve(vp_stack_t *stack, size_t needsize)
 {
+    /* new result: release the previous large result */
+    if (stack->top == stack->buf && (stack->mapped || stack->buf == NULL)) {
+        vp_stack_free(stack);
+        stack->size = VP_WARM_BUFSIZE;
+        stack->buf = vp_stack_warm;
+        stack->top = vp_stack_warm;
+    }
     if (needsize > stack->size) {
         size_t newsize;
         char *newbuf;
 
-        newsize = (stack->size == 0) ? VP_INITIAL_BUFSIZE : (stack->size * 2);
+        newsize = stack->size * 2;
         while (needsize > newsize) {
             newsize *= 2;
             if (newsize <= stack->size) /* paranoid check */
                 return "vp_stack_reserve: too big";
         }
-        if ((newbuf = (char *)realloc(stack->buf, newsize)) == NULL)
+        if ((newbuf = vp_stack_map(newsize)) == NULL)
             return "vp_stack_reserve: NOMEM";
+        memcpy(newbuf, stack->buf, stack->top - stack->buf);
+        if (stack->mapped)
+            vp_stack_unmap(stack->buf, stack->size);
         stack->top = newbuf + (stack->top - stack->buf);
         stack->buf = newbuf;
         stack->size = newsize;
+        stack->mapped = 1;
     }
     return NULL;
 }
 
+/* pop a value [*pval, *pend).  *pend is EOV. */
 static const char *
-vp_stack_pop_num(vp_stack_t *stack, const char *fmt, void *ptr)
+vp_stack_pop_val(vp_stack_t *stack, char **pval, char **pend)
 {
-    char fmtbuf[VP_NUMFMT_BUFSIZE];
-    int n;
     char *top;
 
     if (stack->buf == stack->top)
-        return "vp_stack_pop_num: stack over flow";
+        return "vp_stack_pop: stack over flow";
 
     top = stack->top - 1;
+    *pend = top;
     while (top != stack->buf && top[-1] != VP_EOV)
         --top;
 
-    strcpy(fmtbuf, fmt);
-    strcat(fmtbuf, "%n");
-
-    if (sscanf(top, fmtbuf, ptr, &n) != 1 || top[n] != VP_EOV)
-        return "vp_stack_pop_num: sscanf error";
-
+    *pval = top;
     stack->top = top;
     return NULL;
 }
 
-/* str will be invalid after vp_stack_push_*() */
+/* pop arguments by signature.  see vp_scan.c for type characters.
+ * 's' and 'b' values point into the stack; 'b' is decoded in place. */
 static const char *
-vp_stack_pop_str(vp_stack_t *stack, char **str)
+vp_stack_pop_args(vp_stack_t *stack, const char *sig, ...)
 {
-    char *top;
-
-    if (stack->buf == stack->top)
-        return "vp_stack_pop_str: stack over flow";
-
-    top = stack->top - 1;
-    while (top != stack->buf && top[-1] != VP_EOV)
-        --top;
-
-    *str = top;
-    stack->top[-1] = '\0';
-    stack->top = top;
-    return NULL;
-}
-
-/* bin is hexdump */
-static const char *
-vp_stack_pop_bin(vp_stack_t *stack, char **buf, size_t *size)
-{
-    char *p;
-    unsigned num;
-
-    VP_RETURN_IF_FAIL(vp_stack_pop_str(stack, buf));
-    *size = 0;
-    p = *buf;
-    while (*p) {
-        /* "%0.2x" is warned by gcc. */
-        if (sscanf(p, "%2x", &num) != 1)
-            return "vp_stack_pop_bin: sscanf error";
-        (*buf)[*size] = num;
-        *size += 1;
-        p += 2;
+    va_list ap;
+    const char *err = NULL;
+    char *val;
+    char *end;
+    char **pbuf;
+
+    va_start(ap, sig);
+    for (; *sig != '\0' && err == NULL; ++sig) {
+        if ((err = vp_stack_pop_val(stack, &val, &end)) != NULL)
+            break;
+        switch (*sig) {
+        case 'd':
+            if (vp_scan_int(val, end, va_arg(ap, int *)) != 0)
+                err = "vp_stack_pop_args: number format error";
+            break;
+        case 'h':
+            if (vp_scan_ushort(val, end, va_arg(ap, unsigned short *)) != 0)
+                err = "vp_stack_pop_args: number format error";
+            break;
+        case 'p':
+            if (vp_scan_ptr(val, end, va_arg(ap, void **)) != 0)
+                err = "vp_stack_pop_args: pointer format error";
+            break;
+        case 's':
+            *end = '\0';
+            *va_arg(ap, char **) = val;
+            break;
+        case 'b':
+            pbuf = va_arg(ap, char **);
+            if (vp_scan_hex(val, end, val, va_arg(ap, size_t *)) != 0) {
+                err = "vp_stack_pop_args: hexdump format error";
+                break;
+            }
+            *pbuf = val;
+            break;
+        default:
+            err = "vp_stack_pop_args: unknown signature";
+            break;
+        }
     }
-    return NULL;
+    va_end(ap);
+    return err;
 }
 
 static const char *
 vp_stack_push_num(vp_stack_t *stack, const char *fmt, ...)
 {
     va_list ap;
-    char buf[VP_NUM_BUFSIZE];
+    size_t needsize;
+    int n;
 
+    needsize = (stack->top - stack->buf) + VP_NUM_BUFSIZE + sizeof(VP_EOV_STR);
+    VP_RETURN_IF_FAIL(vp_stack_reserve(stack, needsize));
     va_start(ap, fmt);
-    if (vsprintf(buf, fmt, ap) < 0) {
-        va_end(ap);
-        return "vp_stack_push_num: vsprintf error";
-    }
+    n = vsnprintf(stack->top, VP_NUM_BUFSIZE, fmt, ap);
     va_end(ap);
-    return vp_stack_push_str(stack, buf);
+    if (n < 0 || n >= VP_NUM_BUFSIZE)
+        return "vp_stack_push_num: vsnprintf error";
+    stack->top += n;
+    *(stack->top++) = VP_EOV;
+    return NULL;
 }
 
 static const char *
 vp_stack_push_str(vp_stack_t *stack, const char *str)
 {
     size_t needsize;
+    size_t len;
 
-    needsize = (stack->top - stack->buf) + strlen(str) + sizeof(VP_EOV_STR);
+    len = strlen(str);
+    needsize = (stack->top - stack->buf) + len + sizeof(VP_EOV_STR);
     VP_RETURN_IF_FAIL(vp_stack_reserve(stack, needsize));
-    stack->top += sprintf(stack->top, "%s%c", str, VP_EOV);
+    memcpy(stack->top, str, len);
+    stack->top += len;
+    *(stack->top++) = VP_EOV;
     return NULL;
 }
 
 static const char *
 vp_stack_push_bin(vp_stack_t *stack, const char *buf, size_t size)
 {
+    static const char hex[] = "0123456789ABCDEF";
     size_t needsize;
     size_t i;
 
     needsize = (stack->top - stack->buf) + (size * 2) + sizeof(VP_EOV_STR);
     VP_RETURN_IF_FAIL(vp_stack_reserve(stack, needsize));
-    for (i = 0; i < size; ++i)
-        /* is this slow? */
-        stack->top += sprintf(stack->top, "%02X", buf[i] & 0xFF);
+    for (i = 0; i < size; ++i) {
+        *(stack->top++) = hex[(buf[i] >> 4) & 0xF];
+        *(stack->top++) = hex[buf[i] & 0xF];
+    }
     *(stack->top++) = VP_EOV;
     return NULL;
 }
@@ -0,0 +1,137 @@
+/* 2026-10-19
+ * vim:set sw=4 sts=4 et:
+ */
+#include <stddef.h>
+#include <string.h>
+#include <limits.h>
+
+/*
+ * Decoders for values of the libcall protocol (vimstack and vp_iobuf).
+ * Each decoder parses the whole of [p, end) and returns 0 on success or -1
+ * on format error.  They are used instead of sscanf() which needs a format
+ * string and is slow for such a small input.
+ *
+ * Argument signature is written as a string of type characters:
+ *   d: int             (int *)
+ *   h: unsigned short  (unsigned short *)
+ *   p: pointer         (void **)
+ *   s: string          (char **)
+ *   b: hexdump binary  (char **, size_t *)
+ */
+
+static int vp_scan_xdigit(int c);
+static int vp_scan_long(const char *p, const char *end, long *pnum);
+static int vp_scan_int(const char *p, const char *end, int *pnum);
+static int vp_scan_ushort(const char *p, const char *end, unsigned short *pnum);
+static int vp_scan_ptr(const char *p, const char *end, void **pptr);
+static int vp_scan_hex(const char *p, const char *end, char *buf, size_t *psize);
+
+static int
+vp_scan_xdigit(int c)
+{
+    if ('0' <= c && c <= '9')
+        return c - '0';
+    if ('a' <= c && c <= 'f')
+        return c - 'a' + 10;
+    if ('A' <= c && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static int
+vp_scan_long(const char *p, const char *end, long *pnum)
+{
+    unsigned long n = 0;
+    unsigned long limit = LONG_MAX;
+    unsigned d;
+    int neg = 0;
+
+    if (p != end && (*p == '-' || *p == '+')) {
+        neg = (*p == '-');
+        if (neg)
+            limit = (unsigned long)LONG_MAX + 1;
+        ++p;
+    }
+    if (p == end)
+        return -1;
+    for (; p != end; ++p) {
+        d = (unsigned)(*p - '0');
+        if (d > 9 || n > (limit - d) / 10)
+            return -1;
+        n = n * 10 + d;
+    }
+    if (!neg)
+        *pnum = (long)n;
+    else if (n == 0)
+        *pnum = 0;
+    else
+        *pnum = -(long)(n - 1) - 1;
+    return 0;
+}
+
+static int
+vp_scan_int(const char *p, const char *end, int *pnum)
+{
+    long n;
+
+    if (vp_scan_long(p, end, &n) != 0 || n < INT_MIN || INT_MAX < n)
+        return -1;
+    *pnum = (int)n;
+    return 0;
+}
+
+static int
+vp_scan_ushort(const char *p, const char *end, unsigned short *pnum)
+{
+    long n;
+
+    if (vp_scan_long(p, end, &n) != 0 || n < 0 || USHRT_MAX < n)
+        return -1;
+    *pnum = (unsigned short)n;
+    return 0;
+}
+
+/* accept the output of printf("%p"): "0x1234", "1234" or "(nil)" */
+static int
+vp_scan_ptr(const char *p, const char *end, void **pptr)
+{
+    size_t n = 0;
+    int d;
+
+    if (end - p == 5 && memcmp(p, "(nil)", 5) == 0) {
+        *pptr = NULL;
+        return 0;
+    }
+    if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+        p += 2;
+    if (p == end)
+        return -1;
+    for (; p != end; ++p) {
+        if ((d = vp_scan_xdigit(*p)) < 0)
+            return -1;
+        if ((n >> (sizeof(n) * CHAR_BIT - 4)) != 0)
+            return -1;
+        n = (n << 4) | (size_t)d;
+    }
+    *pptr = (void *)n;
+    return 0;
+}
+
+/* buf can be p.  decoded data is written behind the read position. */
+static int
+vp_scan_hex(const char *p, const char *end, char *buf, size_t *psize)
+{
+    size_t size = 0;
+    int hi;
+    int lo;
+
+    if ((end - p) % 2 != 0)
+        return -1;
+    for (; p != end; p += 2) {
+        if ((hi = vp_scan_xdigit(p[0])) < 0 || (lo = vp_scan_xdigit(p[1])) < 0)
+            return -1;
+        buf[size++] = (char)((hi << 4) | lo);
+    }
+    *psize = size;
+    return 0;
+}
@@ -0,0 +1,125 @@
+/*
+ * Per-argument parse cost of the old sscanf() based decoder and vp_scan.c.
+ *
+ *   make bench
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../autoload/vp_scan.c"
+
+#define LOOP 2000000
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* copy of the old vp_stack_pop_num() */
+static int
+old_scan(const char *str, const char *fmt, void *ptr)
+{
+    char fmtbuf[16];
+    int n;
+
+    strcpy(fmtbuf, fmt);
+    strcat(fmtbuf, "%n");
+    if (sscanf(str, fmtbuf, ptr, &n) != 1 || str[n] != '\0')
+        return -1;
+    return 0;
+}
+
+/* copy of the old vp_stack_pop_bin() */
+static int
+old_hex(char *buf, size_t *size)
+{
+    char *p = buf;
+    unsigned num;
+
+    *size = 0;
+    while (*p) {
+        if (sscanf(p, "%2x", &num) != 1)
+            return -1;
+        buf[*size] = num;
+        *size += 1;
+        p += 2;
+    }
+    return 0;
+}
+
+static void
+report(const char *name, double before, double after, int nargs)
+{
+    printf("%-8s sscanf: %7.1f ns/arg  vp_scan: %7.1f ns/arg  (x%.1f)\n",
+            name, before * 1e9 / nargs, after * 1e9 / nargs, before / after);
+}
+
+int
+main(void)
+{
+    const char *nums[] = {"0", "7", "-1", "1234", "65535", "2147483647"};
+    const char *ptrs[] = {"(nil)", "0x7f3a2c001000", "0x55d0c0ffee10"};
+    char hex[2 * 256 + 1];
+    char buf[sizeof(hex)];
+    size_t size;
+    int num;
+    void *ptr;
+    long sum = 0;
+    double t0, t1, t2;
+    int i;
+
+    for (i = 0; i < 256; ++i)
+        sprintf(hex + i * 2, "%02X", i);
+
+    t0 = now();
+    for (i = 0; i < LOOP; ++i) {
+        old_scan(nums[i % 6], "%d", &num);
+        sum += num;
+    }
+    t1 = now();
+    for (i = 0; i < LOOP; ++i) {
+        const char *s = nums[i % 6];
+        vp_scan_int(s, s + strlen(s), &num);
+        sum += num;
+    }
+    t2 = now();
+    report("int", t1 - t0, t2 - t1, LOOP);
+
+    t0 = now();
+    for (i = 0; i < LOOP; ++i) {
+        old_scan(ptrs[i % 3], "%p", &ptr);
+        sum += (ptr != NULL);
+    }
+    t1 = now();
+    for (i = 0; i < LOOP; ++i) {
+        const char *s = ptrs[i % 3];
+        vp_scan_ptr(s, s + strlen(s), &ptr);
+        sum += (ptr != NULL);
+    }
+    t2 = now();
+    report("ptr", t1 - t0, t2 - t1, LOOP);
+
+    /* 256 bytes hexdump per argument */
+    t0 = now();
+    for (i = 0; i < LOOP / 100; ++i) {
+        strcpy(buf, hex);
+        old_hex(buf, &size);
+        sum += size;
+    }
+    t1 = now();
+    for (i = 0; i < LOOP / 100; ++i) {
+        strcpy(buf, hex);
+        vp_scan_hex(buf, buf + strlen(buf), buf, &size);
+        sum += size;
+    }
+    t2 = now();
+    report("hex256", t1 - t0, t2 - t1, LOOP / 100);
+
+    return (sum == 0);
+}
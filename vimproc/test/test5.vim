@@ -0,0 +1,17 @@
+
+let proc = proc#import()
+
+let sub = proc.ptyopen(["/usr/bin/seq", "1", "200000"])
+call sub.throttle(10, tempname())
+let res = ""
+while !sub.eof
+  let out = sub.read()
+  if out != ""
+    let res = out
+  endif
+endwhile
+call sub.close()
+let [cond, status] = proc.api.vp_waitpid(sub.pid)
+
+new
+call append(0, split(res, '\r\n\|\r\|\n') + [string([cond, status])])
@@ -0,0 +1,14 @@
+
+let proc = proc#import()
+
+let file = proc.open(expand("<sfile>:p:h") . "/euc-jp.txt", "O_RDONLY", 0)
+call file.set_decoder("euc-jp", "utf-8")
+let res = ""
+while !file.eof
+  " split multibyte sequences on purpose
+  let res .= file.read(3)
+endwhile
+call file.close()
+
+new
+call append(0, split(res, '\r\n\|\r\|\n'))